@@ -0,0 +1,50 @@
+#!/bin/sh
+# Benchmark of cachesim: runs a fixed matrix of cache configurations over synthetic traces and reports the
+# simulation speed and peak memory of every run, with the change against a stored baseline.
+# Usage: bench.sh <bench directory> <accesses per trace> <baseline file> [--save]
+# The bench directory holds optimized builds of cachesim and tracegen; the traces are generated there once.
+
+dir=$1
+accesses=$2
+baseline=$3
+save=$4
+
+patterns="seq stride random zipf chase matrix seq,zipf,chase,matrix"
+configs="l1:32768 8 lru 64
+l1-plru:32768 8 plru 64
+l1-stride:32768 8 lru 64 --prefetcher=stride --prefetch-degree=2
+l3-drrip:32768 8 lru 64 --l2=262144,8,srrip,64 --l3=4194304,16,drrip,64 --write-back
+tlb-timing:32768 8 lru 64 --l2=262144,8,lru,64 --tlb=64,4 --l2-tlb=1024,8 --timing
+classify:32768 8 lru 64 --classify"
+
+results=$dir/results.txt
+: > "$results"
+printf "%-28s %-12s %14s %8s %12s %8s\n" pattern config accesses/s change peak-KB change
+
+for pattern in $patterns; do
+    trace=$dir/$(echo "$pattern" | tr , -)-$accesses.bin
+    if [ ! -f "$trace" ]; then
+        "$dir/tracegen" "$pattern" "$accesses" "$dir/trace.txt" || exit 1
+        "$dir/cachesim" --convert "$dir/trace.txt" "$trace" > /dev/null || exit 1
+        rm -f "$dir/trace.txt"
+    fi
+
+    echo "$configs" | while IFS=: read -r name config; do
+        # shellcheck disable=SC2086
+        output=$("$dir/cachesim" --perf $config "$trace") || { echo "$output"; exit 1; }
+        speed=$(echo "$output" | sed -n 's/.*speed: \([0-9]*\) accesses\/s/\1/p')
+        memory=$(echo "$output" | sed -n 's/^Peak memory: \([0-9]*\) KB/\1/p')
+        echo "$pattern $name $speed $memory" >> "$results"
+
+        # Changes are relative to the baseline run of the same pattern and configuration.
+        old=$([ -f "$baseline" ] && grep "^$pattern $name " "$baseline")
+        speedChange=$(echo "$old" | awk -v new="$speed" '$3 { printf "%+.1f%%", 100 * (new - $3) / $3 }')
+        memoryChange=$(echo "$old" | awk -v new="$memory" '$4 { printf "%+.1f%%", 100 * (new - $4) / $4 }')
+        printf "%-28s %-12s %14s %8s %12s %8s\n" "$pattern" "$name" "$speed" "${speedChange:--}" "$memory" "${memoryChange:--}"
+    done || exit 1
+done
+
+if [ "$save" = --save ]; then
+    cp "$results" "$baseline"
+    echo "Saved baseline to $baseline"
+fi
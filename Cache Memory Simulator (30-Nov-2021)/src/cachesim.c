@@ -1,373 +1,3145 @@
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
 
 typedef unsigned long int ulong;
 
 // Struct type to store information needed for a cache line.
-typedef struct _ {
-    int valid, relativeAge, lastAccessed;
+// In a multi-core simulation, a valid line is Modified if dirty, Shared if shared and Exclusive otherwise.
+typedef struct {
     ulong tag;
+    unsigned char valid, dirty, prefetched, shared;
 } cacheLine_t;
 
-// Struct type to store information needed for a cache.
-typedef struct {
-    cacheLine_t ***cache;
-    int numHits, numMisses, numMemReads, numMemWrites;
-} cache_t;
+typedef struct cache_s cache_t;
+
+// Struct type to describe a replacement policy. Each policy keeps lineMetaSize ints of metadata per
+// line and setMetaSize ints per set, so that no policy has to touch every way on every access. onMiss is
+// only called for demand misses, while fills also come from prefetches, write-allocations and victims of
+// exclusive levels.
+typedef struct {
+    const char *name;
+    int lineMetaSize, setMetaSize;
+    void (*onHit)(cache_t *cache, ulong setIndex, int way);
+    void (*onMiss)(cache_t *cache, ulong setIndex);
+    void (*onFill)(cache_t *cache, ulong setIndex, int way);
+    void (*onInvalidate)(cache_t *cache, ulong setIndex, int way);
+    int (*victim)(cache_t *cache, ulong setIndex);
+} replacementPolicy_t;
+
+// Inclusion policies between the levels of a cache hierarchy.
+enum { NON_INCLUSIVE, INCLUSIVE, EXCLUSIVE };
+
+// Results of looking up a block in a cache level.
+enum { ACCESS_MISS, ACCESS_HIT, ACCESS_DIRTY_HIT, ACCESS_PREFETCH_HIT };
+
+// Struct type to store a write buffer between the last cache level and memory (a FIFO of block addresses).
+typedef struct {
+    ulong *entries;
+    int size, count, head;
+    ulong numCoalesced;
+} writeBuffer_t;
+
+// Struct type to store an open addressing hash table from block addresses to ints. Keys are stored plus one
+// so that 0 marks an empty slot, and removals shift the following entries back instead of leaving tombstones.
+// The table doubles whenever it would become more than half full.
+typedef struct {
+    ulong *keys;
+    int *values;
+    unsigned long mask, count;
+} blockTable_t;
+
+// Classes of cache misses. Classifying an access gives the class it has if it misses in the cache.
+enum { MISS_CONFLICT, MISS_CAPACITY, MISS_COMPULSORY };
+
+// Touched blocks are recorded in groups of 64 neighbouring blocks, one bit per block. The classes of a shared
+// classifier wait in a queue of CLASSIFIER_QUEUE entries, enough for the page walk and the demand references
+// of one access.
+#define SEEN_GROUP_BITS 6
+#define CLASSIFIER_QUEUE 8
+
+// Struct type to store a group of touched blocks: the group number plus one (0 marks an empty slot) and a
+// bit mask of the blocks of the group touched so far.
+typedef struct {
+    ulong group, blocks;
+} seenGroup_t;
+
+// Struct type to store the state used to classify the misses of a cache: every block touched so far, and a
+// fully associative LRU shadow cache of the same capacity. The shadow cache maps its blocks to nodes of an
+// intrusive doubly linked list from the most to the least recently used block. The touched blocks are an open
+// addressing table of groups (grown like a block table, so a probe reads one slot for both the group and its
+// mask), only looked up when the shadow cache misses. The levels of both runs that see the same accesses
+// share one classifier: the level that owns it classifies, and the other level reads the classes back from
+// the queue.
+typedef struct {
+    blockTable_t shadow;
+    seenGroup_t *seen;
+    unsigned long seenMask, numSeen;
+    ulong *nodeBlocks;
+    int *prev, *next;
+    int capacity, count, head, tail;
+    unsigned char queue[CLASSIFIER_QUEUE];
+    unsigned queueHead, queueTail;
+} missClassifier_t;
+
+// Timing model: latencies are counted in power of 2 buckets.
+#define LATENCY_BUCKETS 24
+
+// Struct type to store the timing state of a run, attached to its L1 data cache. One access issues per cycle;
+// misses that go to memory need one of numMshrs miss status holding registers and then queue for the memory
+// bus, which is busy for transferCycles per block read or written. readyTimes holds the time at which the
+// data of each L1 data cache line arrives, so hits on lines that are still in flight wait for them.
+// translated is the time at which the page walk of the next access ends.
+typedef struct {
+    int memoryLatency, transferCycles, numMshrs;
+    ulong now, end, busFree, busBusy, translated;
+    ulong *mshrs, *readyTimes;
+    ulong totalLatency, numLatePrefetchHits, lateCycles, numMshrStalls, mshrStallCycles;
+    ulong histogram[LATENCY_BUCKETS];
+} timingModel_t;
+
+// Struct type to store information needed for a cache.
+struct cache_s {
+    const char *name;
+    cacheLine_t *lines;
+    int numSets, numWays, setMetaSize, blockBits, setBits, inclusion, writeBack, writeAllocate;
+    const replacementPolicy_t *policy;
+    int *lineMeta, *setMeta, psel;
+    ulong rng;
+    // The level below (NULL for memory) and the levels directly above this cache.
+    cache_t *next, *above[2];
+    int numAbove;
+    writeBuffer_t writeBuffer;
+    // Block addresses (plus one) of lines evicted by prefetches, to detect misses caused by prefetching.
+    ulong *pollutionFilter;
+    missClassifier_t *classifier;
+    int sharesClassifier;
+    // Hit latency in cycles, and the timing state of the run (L1 data cache only).
+    int latency;
+    timingModel_t *timing;
+    ulong numHits, numMisses, numMemReads, numMemWrites, numWriteBacks, numBackInvalidations;
+    ulong numPrefetches, numUsefulPrefetches, numUnusedPrefetches, numPollutionMisses;
+    ulong numCompulsoryMisses, numCapacityMisses, numConflictMisses;
+};
+
+// Prefetcher limits and the size of the filter that remembers lines evicted by prefetches.
+#define MAX_PREFETCH_DEGREE 16
+#define POLLUTION_FILTER_SIZE 4096
+#define STREAM_WINDOW 16
+
+// Struct type to store an entry of a prefetcher table (a PC-indexed stride entry or a stream).
+typedef struct {
+    ulong tag, lastAddress, lastUse;
+    long stride;
+    int confidence;
+} prefetchEntry_t;
+
+typedef struct prefetcher_s prefetcher_t;
+
+// Struct type to describe a prefetcher. train is called on every demand access to the L1 data cache
+// with the outcome of the access and stores up to degree prefetch addresses in candidates.
+typedef struct {
+    const char *name;
+    int (*train)(prefetcher_t *prefetcher, ulong pc, ulong address, int blockBits, int result, ulong *candidates);
+} prefetcherType_t;
+
+// Struct type to store the state of a prefetcher.
+struct prefetcher_s {
+    const prefetcherType_t *type;
+    int degree, distance, tableSize;
+    prefetchEntry_t *table;
+    ulong clock;
+};
+
+// Levels of a cache hierarchy. The positional cache configuration is the L1 data cache.
+enum { LEVEL_L1D, LEVEL_L1I, LEVEL_L2, LEVEL_L3, MAX_LEVELS };
+
+// Struct type to store the configuration of a cache level.
+typedef struct {
+    const char *name;
+    int cacheSize, associativity, blockSize, writeBack, writeAllocate;
+    const replacementPolicy_t *policy;
+} levelConfig_t;
+
+// Struct type to store the caches of a simulated memory hierarchy (NULL for absent levels).
+typedef struct {
+    cache_t *levels[MAX_LEVELS];
+} hierarchy_t;
+
+// Address translation: a 4-level radix page table (9 index bits per level above the 4K page offset) whose
+// entries live at PAGE_TABLE_BASE, one region of 2^40 bytes per level.
+#define PAGE_TABLE_LEVELS 4
+#define PAGE_TABLE_BASE (1UL << 50)
+
+// Struct type to store the address translation stage of a run. The TLBs and the page walk cache are caches
+// with a block size of 1, looked up with page numbers and page table entry keys. Virtual addresses map to
+// the same physical addresses; only the page walks add memory references.
+typedef struct {
+    cache_t tlbs[2], walkCache;
+    int numTlbs, hasWalkCache, pageBits;
+    ulong numWalks, numWalkReferences, numWalkMisses, numWalkCacheHits;
+} translation_t;
+
+// Binary trace file layout. The file starts with a header followed by blocks of records. Each block
+// is decoded independently (the delta state restarts at every block) and may be LZ compressed.
+#define TRACE_MAGIC "CSBT"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 24
+#define TRACE_BLOCK_HEADER_SIZE 12
+#define TRACE_BLOCK_RECORDS 65536
+#define TRACE_MAX_RECORD_SIZE 20
+#define TRACE_LZ_HASH_BITS 14
+
+// Record encodings of the binary trace format.
+enum { ENCODING_FIXED, ENCODING_DELTA };
+
+// Header flags of the binary trace format.
+enum { TRACE_COMPRESSED = 1 };
+
+// Checkpoint file layout: a header with the format and size of the trace and the position in it, then the
+// state of every cache of both runs.
+#define CHECKPOINT_MAGIC "CSCK"
+#define CHECKPOINT_VERSION 3
+#define CACHE_SHAPE_SIZE 9
+#define MAX_COUNTERS 16
+
+// Struct type to store a single memory access read from a trace.
+typedef struct {
+    ulong pc, address;
+    int isWrite;
+} access_t;
+
+// Struct type to store the state needed to read a text or binary trace. A binary trace ends cleanly only
+// after as many records as its header counts.
+typedef struct {
+    FILE *file;
+    int isBinary, encoding, flags, pcBytes, addrBytes, error;
+    unsigned char *raw, *stored;
+    unsigned long rawSize, pos, remaining, blockRecords;
+    long blockStart;
+    ulong prevPc, prevAddress, numRecords, numRead;
+} traceReader_t;
+
+// Set-sharded simulation: accesses are handed to the shards in epochs of SHARD_EPOCH accesses.
+#define SHARD_EPOCH 65536
+#define MAX_SHARDS 64
+
+// Struct type to store a growable queue of prefetch addresses sent from one shard to another.
+typedef struct {
+    ulong *addresses;
+    unsigned long count, capacity;
+} messageQueue_t;
+
+typedef struct shardedSim_s shardedSim_t;
+
+// Struct type to store a shard: the L1 data cache sets it owns in both runs, its accesses of the
+// current and next epoch, and its outgoing prefetch messages of the current and previous epoch.
+typedef struct {
+    pthread_t thread;
+    int id;
+    shardedSim_t *sim;
+    cache_t caches[2];
+    prefetcher_t prefetcher;
+    access_t *accesses[2];
+    unsigned long numAccesses[2];
+    messageQueue_t outbox[2][MAX_SHARDS];
+} shard_t;
+
+// Struct type to store the state shared by the shards of a sharded simulation.
+struct shardedSim_s {
+    shard_t *shards;
+    int numShards, shardBits, blockBits, setBits, epoch, done;
+    pthread_barrier_t start, end;
+};
+
+// Phase detection: the accesses of an interval are counted per PC in a vector of PHASE_DIMENSIONS hashed
+// buckets (like a basic block vector). An interval whose normalized vector is within PHASE_THRESHOLD
+// (Manhattan distance, out of 2) of a known phase belongs to it; otherwise it starts a new phase.
+#define PHASE_DIMENSIONS 32
+#define PHASE_THRESHOLD 0.3
+#define MAX_PHASES 64
+
+// Struct type to store the state of interval statistics: the output file (CSV or JSON lines), the counters
+// of both runs at the end of the previous interval, the PC vector of the current interval and the phases.
+typedef struct {
+    FILE *file;
+    int json, numPhases;
+    ulong length, count, index;
+    ulong last[2][6];
+    ulong vector[PHASE_DIMENSIONS];
+    double phases[MAX_PHASES][PHASE_DIMENSIONS];
+    ulong phaseIntervals[MAX_PHASES], phaseRepresentatives[MAX_PHASES];
+} intervalStats_t;
+
+// Struct type to store the counters of a PC or an address region in a miss profile. Misses are counted in
+// both runs, and memory traffic in the run without prefetching.
+typedef struct {
+    ulong key, accesses, misses[2], memReads, memWrites, error;
+} profileEntry_t;
+
+// Struct type to store a miss profile keyed by PC or by address region, as a space-saving sketch of at most
+// maxEntries keys. Until it is full, the table maps every key to its entry and the counts are exact. Then a
+// min-heap of the entries by misses of the run without prefetching is built, and a key that misses replaces
+// the entry with the fewest misses, inheriting its misses as error. Accesses of untracked keys that hit in
+// both runs are not counted. The last key counted is remembered, since consecutive accesses often share one.
+typedef struct {
+    blockTable_t table;
+    profileEntry_t *entries;
+    int *heap, *heapIndex;
+    int numEntries, maxEntries, regionBits, full, lastIndex;
+    ulong lastKey;
+} profile_t;
+
+// Coherence protocols of the multi-core simulation, and the maximum number of cores.
+enum { COHERENCE_MSI = 1, COHERENCE_MESI };
+#define MAX_CORES 64
+
+// Struct type to store a core of a multi-core simulation: its trace, its private L1 data cache, the blocks
+// other cores invalidated in it (a later miss on one of them is a coherence miss) and its coherence counters.
+typedef struct {
+    traceReader_t trace;
+    cache_t cache;
+    blockTable_t invalidated;
+    ulong numCoherenceMisses, numInvalidations, numUpgrades, numTransfers;
+} core_t;
+
+// Struct type to store the state of a set-sampled simulation: which L1 data cache sets are simulated,
+// and the accesses and misses (in both runs) of every sampled set.
+typedef struct {
+    unsigned char *sampled;
+    int numSets, numSampled;
+    ulong numAccesses, numSampledAccesses;
+    ulong *accesses, *misses[2];
+} setSampler_t;
+
+// Reuse analysis: blocks are sampled (SHARDS) when their hash, out of REUSE_HASH_RANGE, is below a
+// threshold. Reuse distances are counted in power of 2 buckets.
+#define REUSE_HASH_RANGE (1UL << 24)
+#define REUSE_BUCKETS 48
+#define REUSE_MIN_BLOCKS 64
+
+// Struct type to store a sampled block of a reuse analysis: its last access time and time window.
+typedef struct {
+    ulong block, lastTime, lastWindow;
+} reuseEntry_t;
+
+// Struct type to store a counter of the space-saving sketch of the hottest blocks.
+typedef struct {
+    ulong block, count, error;
+} hotBlock_t;
+
+// Struct type to store the state of a reuse analysis pass. A Fenwick tree over access times marks the
+// last access of every tracked block, so the number of distinct blocks touched since a block's previous
+// access (its LRU stack distance) is a range sum. Times are renumbered once they reach twice maxBlocks,
+// and the sampling threshold is halved (down to 1) whenever more than maxBlocks blocks are tracked.
+typedef struct {
+    int blockBits, maxBlocks, numBlocks, numHot, maxHot;
+    ulong threshold, time, window, windowSize, numAccesses, numWindows;
+    blockTable_t blocks, hot;
+    reuseEntry_t *entries;
+    hotBlock_t *hotBlocks;
+    int *fenwick;
+    double histogram[REUSE_BUCKETS], cold, windowBlocks, minWorkingSet, maxWorkingSet, sumWorkingSet;
+} reuseAnalysis_t;
+
+// Policy parameters for the re-reference interval prediction policies (2-bit RRPVs).
+#define RRIP_MAX 3
+#define BRRIP_LONG_CHANCE 32
+#define DRRIP_LEADER_SETS 32
+#define DRRIP_PSEL_MAX 1023
+
+// Utility function to get the replacement metadata of a line or a set.
+#define LINE_META(cache, setIndex, way) ((cache)->lineMeta + ((setIndex) * (cache)->numWays + (way)) * (cache)->policy->lineMetaSize)
+#define SET_META(cache, setIndex) ((cache)->setMeta + (setIndex) * (cache)->setMetaSize)
+
+// Utility functions to generate a pseudo-random number (xorshift64) from a state, and from the state of a
+// cache, so runs stay reproducible.
+ulong xorshift(ulong *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+ulong nextRandom(cache_t *cache) { return xorshift(&cache->rng); }
+
+// Metadata updates for policies that ignore an event (FIFO hits, random replacement, misses).
+void noUpdate(cache_t *cache, ulong setIndex, int way) {}
+void noMissUpdate(cache_t *cache, ulong setIndex) {}
+
+// LRU and FIFO keep the valid lines of a set in a doubly linked list (line meta: previous, next;
+// set meta: head, tail). New lines are pushed at the head and the victim is always the tail, so both
+// policies are O(1) per access. LRU additionally moves a line to the head when it is hit.
+void listUnlink(cache_t *cache, ulong setIndex, int way) {
+    int *meta = LINE_META(cache, setIndex, way), *set = SET_META(cache, setIndex);
+    if (meta[0] >= 0) LINE_META(cache, setIndex, meta[0])[1] = meta[1];
+    else set[0] = meta[1];
+    if (meta[1] >= 0) LINE_META(cache, setIndex, meta[1])[0] = meta[0];
+    else set[1] = meta[0];
+}
+
+void listPushFront(cache_t *cache, ulong setIndex, int way) {
+    int *meta = LINE_META(cache, setIndex, way), *set = SET_META(cache, setIndex);
+    meta[0] = -1;
+    meta[1] = set[0];
+    if (set[0] >= 0) LINE_META(cache, setIndex, set[0])[0] = way;
+    else set[1] = way;
+    set[0] = way;
+}
+
+void lruHit(cache_t *cache, ulong setIndex, int way) {
+    if (SET_META(cache, setIndex)[0] == way) return;
+    listUnlink(cache, setIndex, way);
+    listPushFront(cache, setIndex, way);
+}
+
+void listFill(cache_t *cache, ulong setIndex, int way) {
+    listPushFront(cache, setIndex, way);
+}
+
+int listVictim(cache_t *cache, ulong setIndex) {
+    int way = SET_META(cache, setIndex)[1];
+    listUnlink(cache, setIndex, way);
+    return way;
+}
+
+// Tree-PLRU keeps numWays - 1 direction bits per set in heap order (set meta, node 1 is the root).
+// Each bit points towards the half of the subtree that should be replaced next. The tree needs a power of
+// 2 associativity, which parseAssociativity guarantees for every level.
+void plruTouch(cache_t *cache, ulong setIndex, int way) {
+    int *tree = SET_META(cache, setIndex), node = 1;
+    for (int bit = cache->numWays >> 1; bit; bit >>= 1) {
+        int right = (way & bit) != 0;
+        tree[node] = !right;
+        node = 2 * node + right;
+    }
+}
+
+int plruVictim(cache_t *cache, ulong setIndex) {
+    int *tree = SET_META(cache, setIndex), node = 1;
+    while (node < cache->numWays) node = 2 * node + tree[node];
+    return node - cache->numWays;
+}
+
+// SRRIP, BRRIP and DRRIP keep a re-reference prediction value per line (line meta). Hits predict a
+// near re-reference, the victim is the first line predicted to be re-referenced in the distant future.
+void rripHit(cache_t *cache, ulong setIndex, int way) {
+    LINE_META(cache, setIndex, way)[0] = 0;
+}
+
+// Function to check whether a set is a DRRIP leader set. Returns 1 for SRRIP leaders, 2 for BRRIP
+// leaders and 0 for followers.
+int drripLeader(cache_t *cache, ulong setIndex) {
+    int period = cache->numSets / DRRIP_LEADER_SETS;
+    if (period < 2) period = 2;
+    if (setIndex % period == 0) return 1;
+    if (setIndex % period == 1) return 2;
+    return 0;
+}
+
+void rripInsert(cache_t *cache, ulong setIndex, int way, int bimodal) {
+    int distant = bimodal && nextRandom(cache) % BRRIP_LONG_CHANCE;
+    LINE_META(cache, setIndex, way)[0] = distant ? RRIP_MAX : RRIP_MAX - 1;
+}
+
+void srripFill(cache_t *cache, ulong setIndex, int way) {
+    rripInsert(cache, setIndex, way, 0);
+}
+
+void brripFill(cache_t *cache, ulong setIndex, int way) {
+    rripInsert(cache, setIndex, way, 1);
+}
+
+// Demand misses in leader sets train the policy selector towards the other policy.
+void drripMiss(cache_t *cache, ulong setIndex) {
+    int leader = drripLeader(cache, setIndex);
+    if (leader == 1 && cache->psel < DRRIP_PSEL_MAX) cache->psel++;
+    if (leader == 2 && cache->psel > 0) cache->psel--;
+}
+
+void drripFill(cache_t *cache, ulong setIndex, int way) {
+    int leader = drripLeader(cache, setIndex);
+    int bimodal = leader ? leader == 2 : cache->psel > DRRIP_PSEL_MAX / 2;
+    rripInsert(cache, setIndex, way, bimodal);
+}
+
+int rripVictim(cache_t *cache, ulong setIndex) {
+    while (1) {
+        for (int i = 0; i < cache->numWays; i++)
+            if (LINE_META(cache, setIndex, i)[0] >= RRIP_MAX) return i;
+        for (int i = 0; i < cache->numWays; i++) LINE_META(cache, setIndex, i)[0]++;
+    }
+}
+
+// Random replacement needs no metadata.
+int randomVictim(cache_t *cache, ulong setIndex) {
+    return nextRandom(cache) % cache->numWays;
+}
+
+// LFU keeps an access count per line (line meta) and replaces the least frequently used line.
+void lfuHit(cache_t *cache, ulong setIndex, int way) {
+    int *count = LINE_META(cache, setIndex, way);
+    if (*count < 0x7fffffff) (*count)++;
+}
+
+void lfuFill(cache_t *cache, ulong setIndex, int way) {
+    LINE_META(cache, setIndex, way)[0] = 1;
+}
+
+int lfuVictim(cache_t *cache, ulong setIndex) {
+    int victim = 0;
+    for (int i = 1; i < cache->numWays; i++)
+        if (LINE_META(cache, setIndex, i)[0] < LINE_META(cache, setIndex, victim)[0]) victim = i;
+    return victim;
+}
+
+// Table of the supported replacement policies, selected by name on the command line.
+const replacementPolicy_t replacementPolicies[] = {
+    {"lru", 2, 2, lruHit, noMissUpdate, listFill, listUnlink, listVictim},
+    {"fifo", 2, 2, noUpdate, noMissUpdate, listFill, listUnlink, listVictim},
+    {"plru", 0, -1, plruTouch, noMissUpdate, plruTouch, noUpdate, plruVictim},
+    {"srrip", 1, 0, rripHit, noMissUpdate, srripFill, noUpdate, rripVictim},
+    {"brrip", 1, 0, rripHit, noMissUpdate, brripFill, noUpdate, rripVictim},
+    {"drrip", 1, 0, rripHit, drripMiss, drripFill, noUpdate, rripVictim},
+    {"random", 0, 0, noUpdate, noMissUpdate, noUpdate, noUpdate, randomVictim},
+    {"lfu", 1, 0, lfuHit, noMissUpdate, lfuFill, noUpdate, lfuVictim},
+};
+
+// Function to find a replacement policy by name. Returns NULL if there is no such policy.
+const replacementPolicy_t *findPolicy(const char *name) {
+    for (int i = 0; i < sizeof(replacementPolicies) / sizeof(replacementPolicies[0]); i++)
+        if (strcmp(replacementPolicies[i].name, name) == 0) return &replacementPolicies[i];
+    return NULL;
+}
+
+// Utility function to calculate log base 2 of a number.
+int _log2(int n) {
+    int i = 0;
+    while (n >>= 1) i++;
+    return i;
+}
+
+// Utility function to hash a 64-bit value (the splitmix64 finalizer).
+ulong mixHash(ulong x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9UL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebUL;
+    return x ^ (x >> 31);
+}
+
+// Function to allocate an empty block table with room for capacity keys (a power of 2).
+void initBlockTable(blockTable_t *table, unsigned long capacity) {
+    table->keys = (ulong *) calloc(capacity, sizeof(ulong));
+    table->values = (int *) malloc(capacity * sizeof(int));
+    table->mask = capacity - 1;
+    table->count = 0;
+}
+
+// Function to free the buffers of a block table.
+void freeBlockTable(blockTable_t *table) {
+    free(table->keys);
+    free(table->values);
+}
+
+// Function to find the value of a key in a block table. Returns NULL if the key is not in the table.
+int *findBlock(blockTable_t *table, ulong key) {
+    for (unsigned long slot = mixHash(key) & table->mask; table->keys[slot]; slot = (slot + 1) & table->mask)
+        if (table->keys[slot] == key + 1) return table->values + slot;
+    return NULL;
+}
+
+void insertBlock(blockTable_t *table, ulong key, int value);
+
+// Function to double the capacity of a block table.
+void growBlockTable(blockTable_t *table) {
+    blockTable_t old = *table;
+    initBlockTable(table, 2 * (old.mask + 1));
+    for (unsigned long slot = 0; slot <= old.mask; slot++)
+        if (old.keys[slot]) insertBlock(table, old.keys[slot] - 1, old.values[slot]);
+    freeBlockTable(&old);
+}
+
+// Function to insert a key that is not in a block table yet.
+void insertBlock(blockTable_t *table, ulong key, int value) {
+    if (2 * (table->count + 1) > table->mask + 1) growBlockTable(table);
+    table->count++;
+    unsigned long slot = mixHash(key) & table->mask;
+    while (table->keys[slot]) slot = (slot + 1) & table->mask;
+    table->keys[slot] = key + 1;
+    table->values[slot] = value;
+}
+
+// Function to remove a key from a block table. Later keys of the same probe run move back into the hole.
+void removeBlock(blockTable_t *table, ulong key) {
+    unsigned long hole = mixHash(key) & table->mask;
+    while (table->keys[hole] != key + 1) hole = (hole + 1) & table->mask;
+    for (unsigned long slot = (hole + 1) & table->mask; table->keys[slot]; slot = (slot + 1) & table->mask) {
+        unsigned long home = mixHash(table->keys[slot] - 1) & table->mask;
+        if (((slot - home) & table->mask) >= ((slot - hole) & table->mask)) {
+            table->keys[hole] = table->keys[slot];
+            table->values[hole] = table->values[slot];
+            hole = slot;
+        }
+    }
+    table->keys[hole] = 0;
+    table->count--;
+}
+
+// Function to allocate the miss classifier of a cache, with a shadow cache of the same number of blocks.
+// The classifier is shared with the same level of the other run if there is one.
+void initClassifier(cache_t *cache, cache_t *other) {
+    missClassifier_t *classifier = (missClassifier_t *) calloc(1, sizeof(missClassifier_t));
+    classifier->capacity = cache->numSets * cache->numWays;
+    classifier->nodeBlocks = (ulong *) malloc(classifier->capacity * sizeof(ulong));
+    classifier->prev = (int *) malloc(classifier->capacity * sizeof(int));
+    classifier->next = (int *) malloc(classifier->capacity * sizeof(int));
+    classifier->head = classifier->tail = -1;
+    classifier->seenMask = 1023;
+    classifier->seen = (seenGroup_t *) calloc(classifier->seenMask + 1, sizeof(seenGroup_t));
+    // The shadow cache table stays at most 1/8 full, so that misses and removals probe short runs.
+    unsigned long slots = 1;
+    while (slots < 8UL * classifier->capacity) slots *= 2;
+    initBlockTable(&classifier->shadow, slots);
+    cache->classifier = classifier;
+    if (other) {
+        other->classifier = classifier;
+        other->sharesClassifier = 1;
+    }
+}
+
+// Utility functions to unlink a node of the shadow cache and to make it the most recently used one.
+void shadowUnlink(missClassifier_t *classifier, int node) {
+    if (classifier->prev[node] >= 0) classifier->next[classifier->prev[node]] = classifier->next[node];
+    else classifier->head = classifier->next[node];
+    if (classifier->next[node] >= 0) classifier->prev[classifier->next[node]] = classifier->prev[node];
+    else classifier->tail = classifier->prev[node];
+}
+
+void shadowPushFront(missClassifier_t *classifier, int node) {
+    classifier->prev[node] = -1;
+    classifier->next[node] = classifier->head;
+    if (classifier->head >= 0) classifier->prev[classifier->head] = node;
+    else classifier->tail = node;
+    classifier->head = node;
+}
+
+// Function to mark a block as touched by a classifier. Returns 1 if it was not touched before.
+int touchBlock(missClassifier_t *classifier, ulong block) {
+    ulong group = (block >> SEEN_GROUP_BITS) + 1, bit = 1UL << (block & ((1 << SEEN_GROUP_BITS) - 1));
+    unsigned long slot = mixHash(group) & classifier->seenMask;
+    for (; classifier->seen[slot].group; slot = (slot + 1) & classifier->seenMask)
+        if (classifier->seen[slot].group == group) {
+            if (classifier->seen[slot].blocks & bit) return 0;
+            classifier->seen[slot].blocks |= bit;
+            return 1;
+        }
+
+    classifier->seen[slot] = (seenGroup_t) {group, bit};
+    // The table doubles once it is half full.
+    if (2 * ++classifier->numSeen > classifier->seenMask + 1) {
+        seenGroup_t *old = classifier->seen;
+        unsigned long oldMask = classifier->seenMask;
+        classifier->seenMask = 2 * oldMask + 1;
+        classifier->seen = (seenGroup_t *) calloc(classifier->seenMask + 1, sizeof(seenGroup_t));
+        for (unsigned long i = 0; i <= oldMask; i++)
+            if (old[i].group) {
+                for (slot = mixHash(old[i].group) & classifier->seenMask; classifier->seen[slot].group; slot = (slot + 1) & classifier->seenMask);
+                classifier->seen[slot] = old[i];
+            }
+        free(old);
+    }
+    return 1;
+}
+
+// Function to access a block in the shadow cache. Returns the class the access has if it misses in the
+// real cache: compulsory for the first touch of a block, capacity if the shadow cache misses too, and
+// conflict otherwise.
+int classifyAccess(missClassifier_t *classifier, ulong block) {
+    int *node = findBlock(&classifier->shadow, block);
+    if (node) {
+        shadowUnlink(classifier, *node);
+        shadowPushFront(classifier, *node);
+        return MISS_CONFLICT;
+    }
+
+    int missClass = touchBlock(classifier, block) ? MISS_COMPULSORY : MISS_CAPACITY, victim;
+
+    if (classifier->count < classifier->capacity) victim = classifier->count++;
+    else {
+        victim = classifier->tail;
+        shadowUnlink(classifier, victim);
+        removeBlock(&classifier->shadow, classifier->nodeBlocks[victim]);
+    }
+    classifier->nodeBlocks[victim] = block;
+    shadowPushFront(classifier, victim);
+    insertBlock(&classifier->shadow, block, victim);
+    return missClass;
+}
+
+// Function to get the class an access to a cache has if it misses. The owner of a shared classifier queues
+// the classes it computes, and the other level takes them from the queue in the same order.
+int missClassOf(cache_t *cache, ulong address) {
+    missClassifier_t *classifier = cache->classifier;
+    if (cache->sharesClassifier) return classifier->queue[classifier->queueHead++ % CLASSIFIER_QUEUE];
+    int missClass = classifyAccess(classifier, address >> cache->blockBits);
+    classifier->queue[classifier->queueTail++ % CLASSIFIER_QUEUE] = missClass;
+    return missClass;
+}
+
+// Function to initialize the cache.
+void initCache(cache_t *cache, const levelConfig_t *config) {
+    int numWays = config->associativity, numSets = config->cacheSize / (config->blockSize * numWays);
+    const replacementPolicy_t *policy = config->policy;
+
+    memset(cache, 0, sizeof(cache_t));
+    cache->name = config->name;
+    cache->numSets = numSets;
+    cache->numWays = numWays;
+    cache->blockBits = _log2(config->blockSize);
+    cache->writeBack = config->writeBack;
+    cache->writeAllocate = config->writeAllocate;
+    cache->setBits = _log2(numSets);
+    // A negative set meta size means one int per way (the PLRU tree).
+    cache->setMetaSize = policy->setMetaSize < 0 ? numWays : policy->setMetaSize;
+    cache->policy = policy;
+    cache->lines = (cacheLine_t *) calloc((size_t) numSets * numWays, sizeof(cacheLine_t));
+    cache->lineMeta = (int *) calloc((size_t) numSets * numWays * policy->lineMetaSize + 1, sizeof(int));
+    cache->setMeta = (int *) calloc((size_t) numSets * cache->setMetaSize + 1, sizeof(int));
+    cache->psel = DRRIP_PSEL_MAX / 2;
+    cache->rng = 0x9e3779b97f4a7c15UL;
+
+    // Empty lists start with no head and no tail.
+    if (policy->onFill == listFill)
+        for (size_t i = 0; i < (size_t) numSets * cache->setMetaSize; i++) cache->setMeta[i] = -1;
+}
+
+// Function to free the memory used by the cache.
+void freeCache(cache_t *cache) {
+    free(cache->writeBuffer.entries);
+    free(cache->pollutionFilter);
+    if (cache->classifier && !cache->sharesClassifier) {
+        free(cache->classifier->seen);
+        freeBlockTable(&cache->classifier->shadow);
+        free(cache->classifier->nodeBlocks);
+        free(cache->classifier->prev);
+        free(cache->classifier->next);
+        free(cache->classifier);
+    }
+    if (cache->timing) {
+        free(cache->timing->mshrs);
+        free(cache->timing->readyTimes);
+        free(cache->timing);
+    }
+    free(cache->lines);
+    free(cache->lineMeta);
+    free(cache->setMeta);
+}
+
+// Function to build a hierarchy from the level configurations (levels with a zero cache size are absent).
+// The levels that talk to memory get a write buffer with writeBufferSize entries.
+void initHierarchy(hierarchy_t *hierarchy, const levelConfig_t *configs, int inclusion, int writeBufferSize) {
+    cache_t *below = NULL;
+    for (int i = MAX_LEVELS - 1; i >= 0; i--) {
+        if (!configs[i].cacheSize) {
+            hierarchy->levels[i] = NULL;
+            continue;
+        }
+
+        cache_t *cache = hierarchy->levels[i] = (cache_t *) malloc(sizeof(cache_t));
+        initCache(cache, &configs[i]);
+        cache->inclusion = inclusion;
+        // Both L1 caches share the first level below them.
+        if (i == LEVEL_L1I) cache->next = hierarchy->levels[LEVEL_L2] ? hierarchy->levels[LEVEL_L2] : hierarchy->levels[LEVEL_L3];
+        else cache->next = below;
+        if (cache->next) cache->next->above[cache->next->numAbove++] = cache;
+        else if (writeBufferSize) {
+            cache->writeBuffer.size = writeBufferSize;
+            cache->writeBuffer.entries = (ulong *) malloc(writeBufferSize * sizeof(ulong));
+        }
+        if (i != LEVEL_L1I) below = cache;
+    }
+}
+
+// Function to free the caches of a hierarchy.
+void freeHierarchy(hierarchy_t *hierarchy) {
+    for (int i = 0; i < MAX_LEVELS; i++)
+        if (hierarchy->levels[i]) {
+            freeCache(hierarchy->levels[i]);
+            free(hierarchy->levels[i]);
+        }
+}
+
+// Utility functions to split an address into the set index and tag of a cache, and to rebuild it.
+ulong setIndexOf(cache_t *cache, ulong address) {
+    return (address >> cache->blockBits) & ((1UL << cache->setBits) - 1);
+}
+
+ulong tagOf(cache_t *cache, ulong address) {
+    return address >> (cache->blockBits + cache->setBits);
+}
+
+ulong lineAddress(cache_t *cache, ulong setIndex, ulong tag) {
+    return (tag << (cache->blockBits + cache->setBits)) | (setIndex << cache->blockBits);
+}
+
+// Function to look up a block in a set. Returns the way holding the block, or -1 on a miss. On a miss,
+// freeWay is set to the first invalid way of the set (or -1 if the set is full).
+int findLine(cache_t *cache, ulong setIndex, ulong tag, int *freeWay) {
+    cacheLine_t *set = cache->lines + setIndex * cache->numWays;
+    *freeWay = -1;
+    for (int i = 0; i < cache->numWays; i++) {
+        if (set[i].valid) {
+            if (set[i].tag == tag) return i;
+        }
+        else if (*freeWay == -1) *freeWay = i;
+    }
+    return -1;
+}
+
+// Function to drop a line from a cache.
+void invalidateLine(cache_t *cache, ulong setIndex, int way) {
+    cache->lines[setIndex * cache->numWays + way].valid = 0;
+    cache->policy->onInvalidate(cache, setIndex, way);
+}
+
+// Function to back-invalidate every copy of a block (of size blockSize) in the levels above a cache.
+// Returns 1 if any of the copies was dirty, so the caller can write the newest data back.
+int backInvalidate(cache_t *cache, ulong address, int blockSize) {
+    int dirty = 0;
+    for (int i = 0; i < cache->numAbove; i++) {
+        cache_t *above = cache->above[i];
+        for (ulong part = address; part < address + blockSize; part += 1UL << above->blockBits) {
+            ulong setIndex = setIndexOf(above, part);
+            int freeWay, way = findLine(above, setIndex, tagOf(above, part), &freeWay);
+            if (way < 0) continue;
+
+            dirty |= above->lines[setIndex * above->numWays + way].dirty;
+            invalidateLine(above, setIndex, way);
+            cache->numBackInvalidations++;
+            dirty |= backInvalidate(above, part, 1 << above->blockBits);
+        }
+    }
+    return dirty;
+}
+
+// Function to send a write to memory through the write buffer. Writes to a block that is already
+// waiting in the buffer are coalesced; when the buffer is full the oldest entry drains to memory.
+void bufferWrite(writeBuffer_t *buffer, ulong blockAddress) {
+    for (int i = 0; i < buffer->count; i++)
+        if (buffer->entries[(buffer->head + i) % buffer->size] == blockAddress) {
+            buffer->numCoalesced++;
+            return;
+        }
+
+    if (buffer->count == buffer->size) {
+        buffer->head = (buffer->head + 1) % buffer->size;
+        buffer->count--;
+    }
+    buffer->entries[(buffer->head + buffer->count++) % buffer->size] = blockAddress;
+}
+
+void writeLevel(cache_t *cache, ulong address);
+
+// Function to write a block to the level below a cache (or to memory).
+void writeBelow(cache_t *cache, ulong address) {
+    cache->numMemWrites++;
+    if (cache->next) writeLevel(cache->next, address);
+    else if (cache->writeBuffer.size) bufferWrite(&cache->writeBuffer, address >> cache->blockBits);
+}
+
+void installLine(cache_t *cache, ulong address, int dirty, int prefetched);
+
+// Function to evict a line to make room for a new block. Inclusive levels back-invalidate the block
+// above them; exclusive levels pass their victims down to the next level. Dirty victims are written back.
+void evictLine(cache_t *cache, ulong setIndex, int way) {
+    cacheLine_t *line = cache->lines + setIndex * cache->numWays + way;
+    ulong address = lineAddress(cache, setIndex, line->tag);
+    int dirty = line->dirty;
+
+    if (line->prefetched) cache->numUnusedPrefetches++;
+    if (cache->inclusion == INCLUSIVE) dirty |= backInvalidate(cache, address, 1 << cache->blockBits);
+    if (cache->inclusion == EXCLUSIVE && cache->next) installLine(cache->next, address, dirty, 0);
+    else if (dirty) {
+        cache->numWriteBacks++;
+        writeBelow(cache, address);
+    }
+}
+
+// Function to load a block into a cache. The block goes into an invalid line if the set has one,
+// otherwise it replaces the line chosen by the replacement policy.
+void installLine(cache_t *cache, ulong address, int dirty, int prefetched) {
+    ulong setIndex = setIndexOf(cache, address), tag = tagOf(cache, address);
+    int freeWay, way = findLine(cache, setIndex, tag, &freeWay);
+    if (way >= 0) {
+        cache->lines[setIndex * cache->numWays + way].dirty |= dirty;
+        return;
+    }
+
+    if (freeWay >= 0) way = freeWay;
+    else {
+        way = cache->policy->victim(cache, setIndex);
+        evictLine(cache, setIndex, way);
+
+        // Remember the victims of prefetches to count the misses they cause.
+        if (prefetched && cache->pollutionFilter) {
+            ulong block = cache->lines[setIndex * cache->numWays + way].tag << cache->setBits | setIndex;
+            cache->pollutionFilter[block % POLLUTION_FILTER_SIZE] = block + 1;
+        }
+    }
+
+    cacheLine_t *line = cache->lines + setIndex * cache->numWays + way;
+    line->valid = 1;
+    line->dirty = dirty;
+    line->prefetched = prefetched;
+    line->tag = tag;
+    cache->policy->onFill(cache, setIndex, way);
+}
+
+// Function to handle a write arriving from the level above (a written-through store or a write-back).
+// Write-back levels keep the block dirty, allocating it without a fetch since the whole block is written.
+void writeLevel(cache_t *cache, ulong address) {
+    ulong setIndex = setIndexOf(cache, address);
+    int freeWay, way = findLine(cache, setIndex, tagOf(cache, address), &freeWay);
+
+    if (way >= 0 && cache->writeBack) cache->lines[setIndex * cache->numWays + way].dirty = 1;
+    else if (way < 0 && cache->writeBack && cache->writeAllocate && cache->inclusion != EXCLUSIVE) installLine(cache, address, 1, 0);
+    else writeBelow(cache, address);
+}
+
+int accessLevel(cache_t *cache, ulong address, int isWrite);
+
+// Function to fetch a block from the level below a cache (or from memory) and load it into the cache.
+// Exclusive levels below the top only keep victims of the levels above, so they do not load it. Returns 1
+// if such a level passes on a dirty block, whose dirty state the level above must then take.
+int fetchBlock(cache_t *cache, ulong address, int dirty, int prefetched) {
+    cache->numMemReads++;
+    if (cache->next && accessLevel(cache->next, address, 0) == ACCESS_DIRTY_HIT) dirty = 1;
+    if (cache->inclusion == EXCLUSIVE && cache->numAbove) return dirty;
+    installLine(cache, address, dirty, prefetched);
+    return 0;
+}
+
+// Function to look up a block in a cache level, fetching it from the level below on a miss.
+// Returns ACCESS_MISS, ACCESS_HIT, ACCESS_PREFETCH_HIT for the first hit on a prefetched line, or
+// ACCESS_DIRTY_HIT when an exclusive level hands a dirty block up (its own, or one passed on from below).
+int accessLevel(cache_t *cache, ulong address, int isWrite) {
+    ulong setIndex = setIndexOf(cache, address);
+    int freeWay, way = findLine(cache, setIndex, tagOf(cache, address), &freeWay);
+    int missClass = cache->classifier ? missClassOf(cache, address) : MISS_CONFLICT;
+
+    // Handle hits in the cache.
+    if (way >= 0) {
+        cacheLine_t *line = cache->lines + setIndex * cache->numWays + way;
+        cache->numHits++;
+        cache->policy->onHit(cache, setIndex, way);
+
+        if (isWrite) {
+            if (cache->writeBack) line->dirty = 1;
+            else writeBelow(cache, address);
+        }
+
+        // In an exclusive hierarchy the block moves up to the level that requested it.
+        if (cache->inclusion == EXCLUSIVE && cache->numAbove) {
+            invalidateLine(cache, setIndex, way);
+            if (line->dirty) return ACCESS_DIRTY_HIT;
+        }
+        if (line->prefetched) {
+            line->prefetched = 0;
+            cache->numUsefulPrefetches++;
+            return ACCESS_PREFETCH_HIT;
+        }
+        return ACCESS_HIT;
+    }
+
+    // Handle misses in the cache. Write misses without write-allocate go straight to the level below.
+    cache->numMisses++;
+    cache->policy->onMiss(cache, setIndex);
+    if (cache->classifier) {
+        if (missClass == MISS_COMPULSORY) cache->numCompulsoryMisses++;
+        else if (missClass == MISS_CAPACITY) cache->numCapacityMisses++;
+        else cache->numConflictMisses++;
+    }
+    if (cache->pollutionFilter) {
+        ulong block = address >> cache->blockBits, *victim = cache->pollutionFilter + block % POLLUTION_FILTER_SIZE;
+        if (*victim == block + 1) {
+            cache->numPollutionMisses++;
+            *victim = 0;
+        }
+    }
+    if (isWrite && !cache->writeAllocate) {
+        writeBelow(cache, address);
+        return ACCESS_MISS;
+    }
+
+    int dirty = fetchBlock(cache, address, isWrite && cache->writeBack, 0);
+    if (isWrite && !cache->writeBack) writeBelow(cache, address);
+    return dirty ? ACCESS_DIRTY_HIT : ACCESS_MISS;
+}
+
+// Next-N-line prefetching: on a miss, prefetch the degree blocks starting distance blocks ahead.
+int nextLineTrain(prefetcher_t *prefetcher, ulong pc, ulong address, int blockBits, int result, ulong *candidates) {
+    if (result != ACCESS_MISS) return 0;
+    for (int i = 0; i < prefetcher->degree; i++) candidates[i] = address + ((ulong) (prefetcher->distance + i) << blockBits);
+    return prefetcher->degree;
+}
+
+// Stride prefetching: a direct-mapped table indexed by PC learns the stride of each load or store and
+// prefetches along it once the same stride has been seen twice in a row.
+int strideTrain(prefetcher_t *prefetcher, ulong pc, ulong address, int blockBits, int result, ulong *candidates) {
+    prefetchEntry_t *entry = prefetcher->table + (pc ^ (pc >> 16)) % prefetcher->tableSize;
+    if (entry->tag != pc) {
+        entry->tag = pc;
+        entry->lastAddress = address;
+        entry->stride = 0;
+        entry->confidence = 0;
+        return 0;
+    }
+
+    long stride = address - entry->lastAddress;
+    entry->lastAddress = address;
+    if (!stride) return 0;
+    if (stride == entry->stride) {
+        if (entry->confidence < 3) entry->confidence++;
+    }
+    else {
+        entry->stride = stride;
+        entry->confidence = 0;
+    }
+
+    if (entry->confidence < 2) return 0;
+    for (int i = 0; i < prefetcher->degree; i++) candidates[i] = address + entry->stride * (prefetcher->distance + i);
+    return prefetcher->degree;
+}
+
+// Stream prefetching: tableSize stream trackers follow misses (and hits on prefetched lines) that fall
+// within STREAM_WINDOW blocks of a stream's last block. A stream that moved twice in the same direction
+// runs ahead of the demand stream by distance blocks.
+int streamTrain(prefetcher_t *prefetcher, ulong pc, ulong address, int blockBits, int result, ulong *candidates) {
+    if (result == ACCESS_HIT) return 0;
+
+    ulong block = address >> blockBits;
+    prefetchEntry_t *stream = NULL, *oldest = prefetcher->table;
+    for (int i = 0; i < prefetcher->tableSize; i++) {
+        prefetchEntry_t *entry = prefetcher->table + i;
+        long delta = block - entry->lastAddress;
+        if (entry->lastUse && delta && delta >= -STREAM_WINDOW && delta <= STREAM_WINDOW) {
+            stream = entry;
+            break;
+        }
+        if (entry->lastUse < oldest->lastUse) oldest = entry;
+    }
+    prefetcher->clock++;
+
+    // Allocate a new stream in place of the least recently used one.
+    if (!stream) {
+        oldest->lastAddress = block;
+        oldest->lastUse = prefetcher->clock;
+        oldest->stride = 0;
+        oldest->confidence = 0;
+        return 0;
+    }
+
+    long direction = block > stream->lastAddress ? 1 : -1;
+    if (direction == stream->stride) {
+        if (stream->confidence < 3) stream->confidence++;
+    }
+    else {
+        stream->stride = direction;
+        stream->confidence = 0;
+    }
+    stream->lastAddress = block;
+    stream->lastUse = prefetcher->clock;
+
+    if (stream->confidence < 1) return 0;
+    for (int i = 0; i < prefetcher->degree; i++)
+        candidates[i] = (block + direction * (prefetcher->distance + i)) << blockBits;
+    return prefetcher->degree;
+}
+
+// Table of the supported prefetchers, selected by name on the command line.
+const prefetcherType_t prefetcherTypes[] = {
+    {"nextline", nextLineTrain},
+    {"stride", strideTrain},
+    {"stream", streamTrain},
+};
+
+// Function to find a prefetcher by name. Returns NULL if there is no such prefetcher.
+const prefetcherType_t *findPrefetcher(const char *name) {
+    for (int i = 0; i < sizeof(prefetcherTypes) / sizeof(prefetcherTypes[0]); i++)
+        if (strcmp(prefetcherTypes[i].name, name) == 0) return &prefetcherTypes[i];
+    return NULL;
+}
+
+// Function to initialize a prefetcher and attach its pollution filter to the cache it prefetches into.
+void initPrefetcher(prefetcher_t *prefetcher, const prefetcherType_t *type, int degree, int distance, int tableSize, cache_t *cache) {
+    prefetcher->type = type;
+    prefetcher->degree = degree;
+    prefetcher->distance = distance;
+    prefetcher->tableSize = tableSize;
+    prefetcher->table = (prefetchEntry_t *) calloc(tableSize, sizeof(prefetchEntry_t));
+    prefetcher->clock = 0;
+    cache->pollutionFilter = (ulong *) calloc(POLLUTION_FILTER_SIZE, sizeof(ulong));
+}
+
+// Function to prefetch a block into a cache unless it is already there.
+void issuePrefetch(cache_t *cache, ulong address) {
+    int freeWay;
+    if (findLine(cache, setIndexOf(cache, address), tagOf(cache, address), &freeWay) >= 0) return;
+    cache->numPrefetches++;
+    fetchBlock(cache, address, 0, 1);
+    // The shadow cache of the classifier takes the prefetched block too, so that the misses the prefetch
+    // causes are counted as capacity misses rather than conflict misses.
+    if (cache->classifier) classifyAccess(cache->classifier, address >> cache->blockBits);
+}
+
+// Function to attach a timing model to the L1 data cache of a run. The latencies of the levels are set on
+// the caches by the caller.
+void initTiming(cache_t *cache, int memoryLatency, int bandwidth, int numMshrs) {
+    timingModel_t *timing = (timingModel_t *) calloc(1, sizeof(timingModel_t));
+    timing->memoryLatency = memoryLatency;
+    timing->transferCycles = ((1 << cache->blockBits) + bandwidth - 1) / bandwidth;
+    timing->numMshrs = numMshrs;
+    timing->mshrs = (ulong *) calloc(numMshrs, sizeof(ulong));
+    timing->readyTimes = (ulong *) calloc((size_t) cache->numSets * cache->numWays, sizeof(ulong));
+    cache->timing = timing;
+}
+
+// Function to record the hit counters of a cache and of the levels below it.
+void snapshotHits(cache_t *cache, ulong *hits) {
+    for (int i = 0; cache; cache = cache->next, i++) hits[i] = cache->numHits;
+}
+
+// Function to get the time at which a block that missed in a cache at time start arrives. The block comes
+// from the first level below whose hit counter moved since the snapshot, or else from memory. A miss to
+// memory first waits for a free MSHR (stalling the issue of later accesses if it is a demand access), and
+// then for the memory bus.
+ulong fillTime(cache_t *cache, const ulong *hits, ulong start, int demand) {
+    timingModel_t *timing = cache->timing;
+    ulong time = start + cache->latency;
+    int i = 1;
+    for (cache_t *level = cache->next; level; level = level->next, i++) {
+        time += level->latency;
+        if (level->numHits != hits[i]) return time;
+    }
+
+    int mshr = 0;
+    for (i = 1; i < timing->numMshrs; i++)
+        if (timing->mshrs[i] < timing->mshrs[mshr]) mshr = i;
+    if (timing->mshrs[mshr] > start) {
+        timing->numMshrStalls++;
+        timing->mshrStallCycles += timing->mshrs[mshr] - start;
+        time += timing->mshrs[mshr] - start;
+        if (demand && timing->mshrs[mshr] > timing->now) timing->now = timing->mshrs[mshr];
+    }
+    if (timing->busFree > time) time = timing->busFree;
+    timing->busFree = time + timing->transferCycles;
+    timing->busBusy += timing->transferCycles;
+    time += timing->memoryLatency;
+    timing->mshrs[mshr] = time;
+    return time;
+}
+
+// Function to set the arrival time of a block in a cache, if the block was loaded into it.
+void setReadyTime(cache_t *cache, ulong address, ulong time) {
+    ulong setIndex = setIndexOf(cache, address);
+    int freeWay, way = findLine(cache, setIndex, tagOf(cache, address), &freeWay);
+    if (way >= 0) cache->timing->readyTimes[setIndex * cache->numWays + way] = time;
+    if (time > cache->timing->end) cache->timing->end = time;
+}
+
+// Function to get the latency of a demand access that started at time start. Hits wait for lines that are
+// still in flight; a hit on a prefetched line that has not arrived yet is a late prefetch hit. A write miss
+// that does not allocate loads no block: it is posted like a hit, and its memory bus cycles are counted
+// with the other memory writes.
+ulong accessLatency(cache_t *cache, ulong address, int isWrite, int result, const ulong *hits, ulong start) {
+    timingModel_t *timing = cache->timing;
+    if (isWrite && !cache->writeAllocate && result == ACCESS_MISS) return cache->latency;
+    if (result == ACCESS_MISS) {
+        ulong time = fillTime(cache, hits, start, 1);
+        setReadyTime(cache, address, time);
+        return time - start;
+    }
+
+    ulong setIndex = setIndexOf(cache, address), latency = cache->latency;
+    int freeWay, way = findLine(cache, setIndex, tagOf(cache, address), &freeWay);
+    ulong ready = way >= 0 ? timing->readyTimes[setIndex * cache->numWays + way] : 0;
+    if (ready > start + latency) {
+        latency = ready - start;
+        if (result == ACCESS_PREFETCH_HIT) {
+            timing->numLatePrefetchHits++;
+            timing->lateCycles += ready - start - cache->latency;
+        }
+    }
+    return latency;
+}
+
+// Function to account for the memory bus cycles of the blocks written to memory by an access. The writes
+// are posted, but no more than one block per MSHR may wait for the bus: beyond that, the issue of later
+// accesses stalls until the bus catches up.
+void timeMemoryWrites(timingModel_t *timing, ulong numWrites, ulong start) {
+    if (!numWrites) return;
+    if (timing->busFree < start) timing->busFree = start;
+    timing->busFree += numWrites * timing->transferCycles;
+    timing->busBusy += numWrites * timing->transferCycles;
+    ulong backlog = (ulong) timing->numMshrs * timing->transferCycles;
+    if (timing->busFree > timing->now + backlog) timing->now = timing->busFree - backlog;
+    if (timing->busFree > timing->end) timing->end = timing->busFree;
+}
+
+// Utility function to get the number of blocks written to memory by a cache and the levels below it.
+ulong memoryWrites(cache_t *cache) {
+    while (cache->next) cache = cache->next;
+    return cache->numMemWrites - cache->writeBuffer.numCoalesced;
+}
+
+// Function to process a memory access. Returns the outcome of the access in the cache.
+int processTransaction(cache_t *cache, prefetcher_t *prefetcher, ulong pc, ulong address, int isWrite, FILE *debugFile) {
+    // Timing: accesses issue one per cycle, and the levels that served them are found from their hit counters.
+    timingModel_t *timing = cache->timing;
+    ulong hits[MAX_LEVELS], writes = 0;
+    if (timing) {
+        timing->now++;
+        snapshotHits(cache, hits);
+        writes = memoryWrites(cache);
+    }
+
+    int result = accessLevel(cache, address, isWrite);
+    if (debugFile) fprintf(debugFile, result != ACCESS_MISS ? "HIT, " : "MISS, ");
+
+    if (timing) {
+        // An access whose translation walked the page table starts when the walk ends.
+        ulong start = timing->translated > timing->now ? timing->translated : timing->now;
+        ulong latency = start - timing->now + accessLatency(cache, address, isWrite, result, hits, start);
+        int bucket = 0;
+        while (latency >> bucket && bucket < LATENCY_BUCKETS - 1) bucket++;
+        timing->histogram[bucket]++;
+        timing->totalLatency += latency;
+    }
+
+    // Prefetching: read the blocks suggested by the prefetcher that are not in the cache yet.
+    if (prefetcher) {
+        ulong candidates[MAX_PREFETCH_DEGREE];
+        int numCandidates = prefetcher->type->train(prefetcher, pc, address, cache->blockBits, result, candidates);
+        for (int i = 0; i < numCandidates; i++) {
+            ulong numPrefetches = cache->numPrefetches;
+            if (timing) snapshotHits(cache, hits);
+            issuePrefetch(cache, candidates[i]);
+            if (timing && cache->numPrefetches != numPrefetches) setReadyTime(cache, candidates[i], fillTime(cache, hits, timing->now, 0));
+        }
+    }
+    if (timing) timeMemoryWrites(timing, memoryWrites(cache) - writes, timing->now);
+
+    // Debugging.
+    if (debugFile) {
+        for (int i = 0; i < cache->numSets; i++) {
+            for (int j = 0; j < cache->numWays; j++) {
+                cacheLine_t *line = cache->lines + i * cache->numWays + j;
+                if (line->valid) fprintf(debugFile, "%lx", line->tag);
+                else fprintf(debugFile, "-");
+                if (j != cache->numWays - 1) fprintf(debugFile, " + ");
+            }
+            fprintf(debugFile, " | ");
+        }
+        fprintf(debugFile, ", MemReads: %lu, MemWrites: %lu\n", cache->numMemReads, cache->numMemWrites);
+    }
+    return result;
+}
+
+// Function to translate the address of an access. A miss in the last TLB walks the page table from the root
+// down to the leaf level of the page size (PT for 4K, PD for 2M, PDPT for 1G pages), skipping the levels
+// above the deepest entry found in the page walk cache. Each page table entry read is a reference to the
+// L1 data cache. With a timing model, each reference starts when the one before it is done, the first one
+// when the access issues, and the lines they load get their arrival times like demand misses. The access
+// itself waits for the end of the walk.
+void translate(translation_t *translation, cache_t *cache, ulong address) {
+    cache_t *lastTlb = &translation->tlbs[translation->numTlbs - 1];
+    ulong tlbMisses = lastTlb->numMisses;
+    accessLevel(&translation->tlbs[0], address >> translation->pageBits, 0);
+    if (lastTlb->numMisses == tlbMisses) return;
+
+    translation->numWalks++;
+    int leaf = PAGE_TABLE_LEVELS - 1 - (translation->pageBits - 12) / 9, first = 0;
+    for (int level = leaf - 1; level >= 0 && translation->hasWalkCache; level--) {
+        ulong key = (ulong) level << 56 | address >> (39 - 9 * level);
+        if (accessLevel(&translation->walkCache, key, 0) != ACCESS_MISS) {
+            translation->numWalkCacheHits++;
+            first = level + 1;
+            break;
+        }
+    }
+
+    timingModel_t *timing = cache->timing;
+    ulong hits[MAX_LEVELS], writes = timing ? memoryWrites(cache) : 0, time = timing ? timing->now + 1 : 0;
+    for (int level = first; level <= leaf; level++) {
+        ulong misses = cache->numMisses, entry = PAGE_TABLE_BASE + ((ulong) level << 40) + (address >> (39 - 9 * level)) * 8;
+        if (timing) snapshotHits(cache, hits);
+        int result = accessLevel(cache, entry, 0);
+        translation->numWalkReferences++;
+        translation->numWalkMisses += cache->numMisses != misses;
+        if (timing) time += accessLatency(cache, entry, 0, result, hits, time);
+    }
+    if (timing) {
+        timeMemoryWrites(timing, memoryWrites(cache) - writes, timing->now + 1);
+        timing->translated = time;
+    }
+}
+
+// Function to print the statistics of the address translation stage of a run.
+void printTranslation(translation_t *translation) {
+    for (int i = 0; i < translation->numTlbs; i++) {
+        cache_t *tlb = &translation->tlbs[i];
+        ulong lookups = tlb->numHits + tlb->numMisses;
+        printf("L%d TLB hits: %lu, misses: %lu (%.2f%%)\n", i + 1, tlb->numHits, tlb->numMisses, lookups ? 100.0 * tlb->numMisses / lookups : 0.0);
+    }
+    printf("Page walks: %lu, walk references: %lu (%.2f per walk), L1 data cache misses: %lu, walk cache hits: %lu\n",
+           translation->numWalks, translation->numWalkReferences,
+           translation->numWalks ? (double) translation->numWalkReferences / translation->numWalks : 0.0,
+           translation->numWalkMisses, translation->numWalkCacheHits);
+}
+
+// Function to parse the associativity of a cache ("direct", "assoc" or "assoc:n"). Returns 0 if the
+// associativity is not a power of 2.
+int parseAssociativity(const char *str, int numBlocks) {
+    // Initially assume fully associative cache for simplicity of parsing.
+    int associativity = numBlocks;
+
+    if (strcmp(str, "direct") == 0) associativity = 1;
+    else if (strcmp(str, "assoc")) {
+        char *dup = strdup(str);
+        associativity = atoi(strtok(dup, "assoc:"));
+        free(dup);
+    }
+
+    return associativity > 0 && !(associativity & (associativity - 1)) ? associativity : 0;
+}
+
+// Function to parse a cache level specification "<cache size>,<associativity>,<replacement policy>,<block size>",
+// the same order as the positional arguments. Returns 0 on success.
+int parseLevel(levelConfig_t *config, const char *spec) {
+    char *dup = strdup(spec), *fields[4], *rest = dup;
+    int numFields = 0;
+    for (char *field; numFields < 4 && (field = strsep(&rest, ",")); ) fields[numFields++] = field;
+
+    int status = 1;
+    if (numFields == 4 && !rest) {
+        config->cacheSize = atoi(fields[0]);
+        config->blockSize = atoi(fields[3]);
+        config->policy = findPolicy(fields[2]);
+        config->associativity = config->blockSize > 0 ? parseAssociativity(fields[1], config->cacheSize / config->blockSize) : 0;
+        status = !config->policy || !config->associativity || config->cacheSize & (config->cacheSize - 1)
+                 || config->blockSize & (config->blockSize - 1) || config->cacheSize < config->blockSize * config->associativity;
+    }
+    free(dup);
+    return status;
+}
+
+// Utility function to scale a counter of the sampled sets up to the whole trace.
+ulong extrapolate(const setSampler_t *sampler, ulong count) {
+    if (!sampler || !sampler->numSampledAccesses) return count;
+    return (ulong) ((double) count * sampler->numAccesses / sampler->numSampledAccesses + 0.5);
+}
+
+// Function to parse a TLB specification "<entries>,<associativity>" into a cache configuration with a block
+// size of 1. Returns 0 on success.
+int parseTlb(levelConfig_t *config, const char *spec) {
+    char *dup = strdup(spec), *comma = strchr(dup, ',');
+    int status = 1;
+    if (comma) {
+        *comma = '\0';
+        config->cacheSize = atoi(dup);
+        config->blockSize = 1;
+        config->policy = findPolicy("lru");
+        config->associativity = config->cacheSize > 0 ? parseAssociativity(comma + 1, config->cacheSize) : 0;
+        status = !config->associativity || config->cacheSize & (config->cacheSize - 1) || config->cacheSize < config->associativity;
+    }
+    free(dup);
+    return status;
+}
+
+// Function to print the statistics of every level of a hierarchy (scaled up to the whole trace if sampled).
+void printHierarchy(hierarchy_t *hierarchy, const setSampler_t *sampler) {
+    for (int i = 0; i < MAX_LEVELS; i++) {
+        cache_t *cache = hierarchy->levels[i];
+        if (!cache) continue;
+        printf("%s hits: %lu, misses: %lu, reads: %lu, writes: %lu, write-backs: %lu, back-invalidations: %lu\n", cache->name,
+               extrapolate(sampler, cache->numHits), extrapolate(sampler, cache->numMisses), extrapolate(sampler, cache->numMemReads),
+               extrapolate(sampler, cache->numMemWrites), extrapolate(sampler, cache->numWriteBacks), extrapolate(sampler, cache->numBackInvalidations));
+        if (cache->classifier)
+            printf("%s compulsory misses: %lu, capacity misses: %lu, conflict misses: %lu\n", cache->name,
+                   cache->numCompulsoryMisses, cache->numCapacityMisses, cache->numConflictMisses);
+    }
+}
+
+// Utility function to store an integer as a little-endian value of the given width.
+void putLE(unsigned char *buf, ulong value, int width) {
+    for (int i = 0; i < width; i++) buf[i] = (value >> (8 * i)) & 0xff;
+}
+
+// Utility function to load a little-endian value of the given width.
+ulong getLE(const unsigned char *buf, int width) {
+    ulong value = 0;
+    for (int i = 0; i < width; i++) value |= (ulong) buf[i] << (8 * i);
+    return value;
+}
+
+// Utility function to encode a varint (7 bits per byte). Returns the number of bytes written.
+int putVarint(unsigned char *buf, ulong value) {
+    int n = 0;
+    while (value >= 0x80) {
+        buf[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    buf[n++] = value;
+    return n;
+}
+
+// Utility function to decode a varint without reading past end. Returns 0 if the varint is truncated.
+int getVarint(const unsigned char **buf, const unsigned char *end, ulong *value) {
+    const unsigned char *p = *buf;
+    ulong result = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        result |= (ulong) (*p & 0x7f) << shift;
+        if (!(*p++ & 0x80)) {
+            *buf = p;
+            *value = result;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Utility functions to map signed deltas to unsigned integers and back (zigzag encoding).
+ulong zigzag(ulong delta) { return (delta << 1) ^ (ulong) ((long) delta >> 63); }
+ulong unzigzag(ulong value) { return (value >> 1) ^ -(value & 1); }
+
+// Utility function to calculate the number of bytes needed to store a value.
+int bytesNeeded(ulong value) {
+    int n = 1;
+    while (n < 8 && value >> (8 * n)) n++;
+    return n;
+}
+
+// Function to compress a block with a small LZ77 scheme. The output is a sequence of
+// (literal length, literals, match offset, match length - 4) varint groups terminated by offset 0.
+// Returns the compressed size, or 0 if the block would not shrink.
+unsigned long lzCompress(const unsigned char *src, unsigned long size, unsigned char *dst, unsigned long cap) {
+    unsigned int table[1 << TRACE_LZ_HASH_BITS];
+    unsigned long i = 0, anchor = 0, out = 0;
+    memset(table, 0, sizeof(table));
+
+    while (i + 4 <= size) {
+        unsigned int sequence;
+        memcpy(&sequence, src + i, 4);
+        unsigned int hash = (sequence * 2654435761u) >> (32 - TRACE_LZ_HASH_BITS);
+        unsigned long candidate = table[hash];
+        table[hash] = i + 1;
+
+        if (!candidate || memcmp(src + candidate - 1, src + i, 4)) {
+            i++;
+            continue;
+        }
+
+        // Extend the match as far as possible.
+        unsigned long match = candidate - 1, length = 4;
+        while (i + length < size && src[match + length] == src[i + length]) length++;
+
+        if (out + (i - anchor) + 30 > cap) return 0;
+        out += putVarint(dst + out, i - anchor);
+        memcpy(dst + out, src + anchor, i - anchor);
+        out += i - anchor;
+        out += putVarint(dst + out, i - match);
+        out += putVarint(dst + out, length - 4);
+        i += length;
+        anchor = i;
+    }
+
+    // Emit the trailing literals and the terminator.
+    if (out + (size - anchor) + 20 > cap) return 0;
+    out += putVarint(dst + out, size - anchor);
+    memcpy(dst + out, src + anchor, size - anchor);
+    out += size - anchor;
+    out += putVarint(dst + out, 0);
+    return out;
+}
+
+// Function to decompress a block produced by lzCompress. Returns the decompressed size, or 0 if the block is corrupt.
+unsigned long lzDecompress(const unsigned char *src, unsigned long size, unsigned char *dst, unsigned long cap) {
+    const unsigned char *p = src, *end = src + size;
+    unsigned long out = 0;
+
+    while (1) {
+        ulong literals, offset, length;
+        if (!getVarint(&p, end, &literals) || literals > (ulong) (end - p) || out + literals > cap) return 0;
+        memcpy(dst + out, p, literals);
+        p += literals;
+        out += literals;
+
+        if (!getVarint(&p, end, &offset)) return 0;
+        if (!offset) return out;
+        if (!getVarint(&p, end, &length) || offset > out || out + length + 4 > cap) return 0;
+
+        // Copy byte by byte since the match may overlap the output.
+        for (ulong i = 0; i < length + 4; i++, out++) dst[out] = dst[out - offset];
+    }
+}
+
+// Function to open a text or binary trace. Binary traces are recognized by their magic number.
+// Returns 0 on success.
+int openTrace(traceReader_t *trace, const char *path) {
+    memset(trace, 0, sizeof(traceReader_t));
+    trace->file = fopen(path, "rb");
+    if (!trace->file) return 1;
+
+    unsigned char header[TRACE_HEADER_SIZE];
+    if (fread(header, 1, TRACE_HEADER_SIZE, trace->file) != TRACE_HEADER_SIZE || memcmp(header, TRACE_MAGIC, 4)) {
+        rewind(trace->file);
+        return 0;
+    }
+
+    trace->isBinary = 1;
+    trace->encoding = header[5];
+    trace->flags = header[6];
+    trace->pcBytes = header[7];
+    trace->addrBytes = header[8];
+    trace->numRecords = getLE(header + 16, 8);
+    if (header[4] != TRACE_VERSION || trace->encoding > ENCODING_DELTA || trace->pcBytes > 8 || trace->addrBytes > 8) {
+        fclose(trace->file);
+        return 1;
+    }
+
+    trace->raw = (unsigned char *) malloc(TRACE_BLOCK_RECORDS * TRACE_MAX_RECORD_SIZE);
+    trace->stored = (unsigned char *) malloc(TRACE_BLOCK_RECORDS * TRACE_MAX_RECORD_SIZE);
+    return 0;
+}
+
+// Function to load the next block of a binary trace. Returns 0 at the end of the trace, which is an error
+// if it cuts a block header or comes before all the records of the trace header.
+int readTraceBlock(traceReader_t *trace) {
+    unsigned char header[TRACE_BLOCK_HEADER_SIZE];
+    trace->blockStart = ftell(trace->file);
+    size_t headerSize = fread(header, 1, TRACE_BLOCK_HEADER_SIZE, trace->file);
+    if (headerSize != TRACE_BLOCK_HEADER_SIZE) {
+        trace->error = headerSize || trace->numRead != trace->numRecords;
+        return 0;
+    }
+
+    unsigned long numRecords = getLE(header, 4), rawSize = getLE(header + 4, 4), storedSize = getLE(header + 8, 4);
+    if (!numRecords || numRecords > TRACE_BLOCK_RECORDS || rawSize > TRACE_BLOCK_RECORDS * TRACE_MAX_RECORD_SIZE || storedSize > rawSize) {
+        trace->error = 1;
+        return 0;
+    }
+
+    // Blocks that did not shrink are stored uncompressed.
+    if (storedSize == rawSize) {
+        if (fread(trace->raw, 1, rawSize, trace->file) != rawSize) trace->error = 1;
+    }
+    else if (fread(trace->stored, 1, storedSize, trace->file) != storedSize
+             || lzDecompress(trace->stored, storedSize, trace->raw, rawSize) != rawSize)
+        trace->error = 1;
+    if (trace->error) return 0;
+
+    trace->rawSize = rawSize;
+    trace->pos = 0;
+    trace->remaining = trace->blockRecords = numRecords;
+    trace->prevPc = 0;
+    trace->prevAddress = 0;
+    return 1;
+}
+
+// Function to read the next memory access from a trace. Returns 0 at the end of the trace.
+int readAccess(traceReader_t *trace, access_t *access) {
+    if (!trace->isBinary) {
+        char accessType;
+        if (fscanf(trace->file, "%lx: %c %lx", &access->pc, &accessType, &access->address) != 3) return 0;
+        access->isWrite = accessType == 'W';
+        return 1;
+    }
+
+    if (!trace->remaining && !readTraceBlock(trace)) return 0;
+
+    const unsigned char *p = trace->raw + trace->pos, *end = trace->raw + trace->rawSize;
+    ulong packed;
+    if (trace->encoding == ENCODING_FIXED) {
+        if (end - p < trace->pcBytes + trace->addrBytes) {
+            trace->error = 1;
+            return 0;
+        }
+        access->pc = getLE(p, trace->pcBytes);
+        packed = getLE(p + trace->pcBytes, trace->addrBytes);
+        access->address = packed >> 1;
+        p += trace->pcBytes + trace->addrBytes;
+    }
+    else {
+        ulong pcDelta;
+        if (!getVarint(&p, end, &packed) || !getVarint(&p, end, &pcDelta)) {
+            trace->error = 1;
+            return 0;
+        }
+        access->address = trace->prevAddress += unzigzag(packed >> 1);
+        access->pc = trace->prevPc += unzigzag(pcDelta);
+    }
+    access->isWrite = packed & 1;
+
+    trace->pos = p - trace->raw;
+    trace->remaining--;
+    trace->numRead++;
+    return 1;
+}
+
+// Function to close a trace and free its buffers.
+void closeTrace(traceReader_t *trace) {
+    fclose(trace->file);
+    free(trace->raw);
+    free(trace->stored);
+}
+
+// Function to write a block of encoded records to a binary trace, compressing it if requested.
+void writeTraceBlock(FILE *file, unsigned char *raw, unsigned long rawSize, unsigned long numRecords, int compress, unsigned char *scratch) {
+    unsigned char header[TRACE_BLOCK_HEADER_SIZE];
+    unsigned long storedSize = compress ? lzCompress(raw, rawSize, scratch, rawSize - 1) : 0;
+
+    putLE(header, numRecords, 4);
+    putLE(header + 4, rawSize, 4);
+    putLE(header + 8, storedSize ? storedSize : rawSize, 4);
+    fwrite(header, 1, TRACE_BLOCK_HEADER_SIZE, file);
+    fwrite(storedSize ? scratch : raw, 1, storedSize ? storedSize : rawSize, file);
+}
+
+// Function to convert a trace (text or binary) into the binary trace format. Returns 0 on success.
+int convertTrace(const char *inPath, const char *outPath, int encoding, int compress) {
+    traceReader_t trace;
+    access_t access;
+    ulong maxPc = 0, maxPacked = 0, numRecords = 0, pcBytes = 8, addrBytes = 8;
+
+    // Fixed-width records need the widest PC and address, so scan the input once up front.
+    if (encoding == ENCODING_FIXED) {
+        if (openTrace(&trace, inPath)) {
+            printf("Could not open trace file\n");
+            return 1;
+        }
+        while (readAccess(&trace, &access)) {
+            if (access.pc > maxPc) maxPc = access.pc;
+            if ((access.address << 1 | 1) > maxPacked) maxPacked = access.address << 1 | 1;
+        }
+        closeTrace(&trace);
+        pcBytes = bytesNeeded(maxPc);
+        addrBytes = bytesNeeded(maxPacked);
+    }
+
+    if (openTrace(&trace, inPath)) {
+        printf("Could not open trace file\n");
+        return 1;
+    }
+    FILE *outFile = fopen(outPath, "wb");
+    if (!outFile) {
+        printf("Could not open output file\n");
+        closeTrace(&trace);
+        return 1;
+    }
+
+    unsigned char header[TRACE_HEADER_SIZE] = {0};
+    memcpy(header, TRACE_MAGIC, 4);
+    header[4] = TRACE_VERSION;
+    header[5] = encoding;
+    header[6] = compress ? TRACE_COMPRESSED : 0;
+    header[7] = pcBytes;
+    header[8] = addrBytes;
+    fwrite(header, 1, TRACE_HEADER_SIZE, outFile);
+
+    unsigned char *raw = (unsigned char *) malloc(TRACE_BLOCK_RECORDS * TRACE_MAX_RECORD_SIZE);
+    unsigned char *scratch = (unsigned char *) malloc(TRACE_BLOCK_RECORDS * TRACE_MAX_RECORD_SIZE);
+    unsigned long rawSize = 0, blockRecords = 0;
+    ulong prevPc = 0, prevAddress = 0;
+    int status = 0;
+
+    while (readAccess(&trace, &access)) {
+        // The delta encoding packs the access type below the address delta, which needs one spare bit.
+        if (access.address >> 62 || access.pc >> 62) {
+            printf("Addresses must fit in 62 bits\n");
+            status = 1;
+            break;
+        }
+
+        if (encoding == ENCODING_FIXED) {
+            putLE(raw + rawSize, access.pc, pcBytes);
+            putLE(raw + rawSize + pcBytes, access.address << 1 | access.isWrite, addrBytes);
+            rawSize += pcBytes + addrBytes;
+        }
+        else {
+            rawSize += putVarint(raw + rawSize, zigzag(access.address - prevAddress) << 1 | access.isWrite);
+            rawSize += putVarint(raw + rawSize, zigzag(access.pc - prevPc));
+            prevAddress = access.address;
+            prevPc = access.pc;
+        }
+        numRecords++;
+
+        if (++blockRecords == TRACE_BLOCK_RECORDS) {
+            writeTraceBlock(outFile, raw, rawSize, blockRecords, compress, scratch);
+            rawSize = blockRecords = prevPc = prevAddress = 0;
+        }
+    }
+    if (blockRecords) writeTraceBlock(outFile, raw, rawSize, blockRecords, compress, scratch);
+    if (trace.error) {
+        printf("Corrupt trace file\n");
+        status = 1;
+    }
+
+    // Record the total number of accesses in the header.
+    long outSize = ftell(outFile);
+    putLE(header + 16, numRecords, 8);
+    fseek(outFile, 0, SEEK_SET);
+    fwrite(header, 1, TRACE_HEADER_SIZE, outFile);
+
+    if (!status) printf("Converted %lu accesses into %ld bytes\n", numRecords, outSize);
+    fclose(outFile);
+    closeTrace(&trace);
+    free(raw);
+    free(scratch);
+    return status;
+}
+
+// Function to get the position of a trace: the file offset to seek to, and the number of records to skip
+// after it (binary traces are positioned at the start of the current block).
+long traceOffset(traceReader_t *trace, ulong *skip) {
+    *skip = trace->isBinary && trace->remaining ? trace->blockRecords - trace->remaining : 0;
+    return *skip ? trace->blockStart : ftell(trace->file);
+}
+
+// Function to describe a trace by its format (binary or text, record encoding and flags) and the size of
+// its file, so that a checkpoint is only restored on the trace it was taken from.
+void describeTrace(traceReader_t *trace, long *description) {
+    struct stat info;
+    description[0] = trace->isBinary;
+    description[1] = trace->encoding;
+    description[2] = trace->flags;
+    description[3] = fstat(fileno(trace->file), &info) ? -1 : (long) info.st_size;
+}
+
+// Function to move a trace to a position returned by traceOffset, numRead accesses into the trace.
+// Returns 0 on success.
+int seekTrace(traceReader_t *trace, long offset, ulong skip, ulong numRead) {
+    access_t access;
+    trace->remaining = 0;
+    if (fseek(trace->file, offset, SEEK_SET)) return 1;
+    for (ulong i = 0; i < skip; i++)
+        if (!readAccess(trace, &access)) return 1;
+    trace->numRead = numRead;
+    return 0;
+}
+
+// Function to get pointers to the counters of a cache (to save, restore and reset them). Returns their number.
+int cacheCounters(cache_t *cache, ulong **counters) {
+    ulong *list[] = {&cache->numHits, &cache->numMisses, &cache->numMemReads, &cache->numMemWrites, &cache->numWriteBacks,
+                     &cache->numBackInvalidations, &cache->numPrefetches, &cache->numUsefulPrefetches, &cache->numUnusedPrefetches,
+                     &cache->numPollutionMisses, &cache->numCompulsoryMisses, &cache->numCapacityMisses, &cache->numConflictMisses,
+                     &cache->writeBuffer.numCoalesced};
+    memcpy(counters, list, sizeof(list));
+    return sizeof(list) / sizeof(list[0]);
+}
+
+// Function to get the shape of a cache that a checkpoint must match: its geometry, replacement policy, write
+// buffer, pollution filter, inclusion and write policies.
+void cacheShape(cache_t *cache, int *shape) {
+    int list[CACHE_SHAPE_SIZE] = {cache->numSets, cache->numWays, cache->blockBits, cache->policy - replacementPolicies,
+                                  cache->writeBuffer.size, cache->pollutionFilter != NULL, cache->inclusion, cache->writeBack,
+                                  cache->writeAllocate};
+    memcpy(shape, list, sizeof(list));
+}
+
+// Function to write the state of a cache to a checkpoint: its shape (checked on restore), lines, replacement
+// metadata, counters, write buffer and pollution filter.
+void saveCache(FILE *file, cache_t *cache) {
+    int shape[CACHE_SHAPE_SIZE];
+    cacheShape(cache, shape);
+    size_t numLines = (size_t) cache->numSets * cache->numWays;
+    ulong *counters[MAX_COUNTERS];
+    int numCounters = cacheCounters(cache, counters);
+
+    fwrite(shape, sizeof(int), CACHE_SHAPE_SIZE, file);
+    fwrite(cache->lines, sizeof(cacheLine_t), numLines, file);
+    fwrite(cache->lineMeta, sizeof(int), numLines * cache->policy->lineMetaSize + 1, file);
+    fwrite(cache->setMeta, sizeof(int), (size_t) cache->numSets * cache->setMetaSize + 1, file);
+    fwrite(&cache->psel, sizeof(int), 1, file);
+    fwrite(&cache->rng, sizeof(ulong), 1, file);
+    for (int i = 0; i < numCounters; i++) fwrite(counters[i], sizeof(ulong), 1, file);
+    if (cache->writeBuffer.size) fwrite(cache->writeBuffer.entries, sizeof(ulong), cache->writeBuffer.size, file);
+    fwrite(&cache->writeBuffer.count, sizeof(int), 1, file);
+    fwrite(&cache->writeBuffer.head, sizeof(int), 1, file);
+    if (cache->pollutionFilter) fwrite(cache->pollutionFilter, sizeof(ulong), POLLUTION_FILTER_SIZE, file);
+}
+
+// Function to read the state of a cache from a checkpoint. Returns 0 on success, or 1 if the checkpoint
+// is truncated or was taken with a different configuration.
+int loadCache(FILE *file, cache_t *cache) {
+    int shape[CACHE_SHAPE_SIZE], expected[CACHE_SHAPE_SIZE];
+    cacheShape(cache, expected);
+    if (fread(shape, sizeof(int), CACHE_SHAPE_SIZE, file) != CACHE_SHAPE_SIZE || memcmp(shape, expected, sizeof(shape))) return 1;
+
+    size_t numLines = (size_t) cache->numSets * cache->numWays, lineMetaSize = numLines * cache->policy->lineMetaSize + 1;
+    size_t setMetaSize = (size_t) cache->numSets * cache->setMetaSize + 1;
+    ulong *counters[MAX_COUNTERS];
+    int numCounters = cacheCounters(cache, counters), ok = 1;
+
+    ok &= fread(cache->lines, sizeof(cacheLine_t), numLines, file) == numLines;
+    ok &= fread(cache->lineMeta, sizeof(int), lineMetaSize, file) == lineMetaSize;
+    ok &= fread(cache->setMeta, sizeof(int), setMetaSize, file) == setMetaSize;
+    ok &= fread(&cache->psel, sizeof(int), 1, file) == 1;
+    ok &= fread(&cache->rng, sizeof(ulong), 1, file) == 1;
+    for (int i = 0; i < numCounters; i++) ok &= fread(counters[i], sizeof(ulong), 1, file) == 1;
+    if (cache->writeBuffer.size) ok &= fread(cache->writeBuffer.entries, sizeof(ulong), cache->writeBuffer.size, file) == (size_t) cache->writeBuffer.size;
+    ok &= fread(&cache->writeBuffer.count, sizeof(int), 1, file) == 1;
+    ok &= fread(&cache->writeBuffer.head, sizeof(int), 1, file) == 1;
+    if (cache->pollutionFilter) ok &= fread(cache->pollutionFilter, sizeof(ulong), POLLUTION_FILTER_SIZE, file) == POLLUTION_FILTER_SIZE;
+    ok &= cache->writeBuffer.count >= 0 && cache->writeBuffer.count <= cache->writeBuffer.size
+          && cache->writeBuffer.head >= 0 && cache->writeBuffer.head < (cache->writeBuffer.size ? cache->writeBuffer.size : 1);
+    return !ok;
+}
+
+// Function to call a function on every cache of a run: the levels of its hierarchy, then its TLBs and page
+// walk cache if it translates addresses.
+void forEachCache(hierarchy_t *hierarchy, translation_t *translation, void (*visit)(cache_t *cache, void *arg), void *arg) {
+    for (int i = 0; i < MAX_LEVELS; i++)
+        if (hierarchy->levels[i]) visit(hierarchy->levels[i], arg);
+    if (!translation) return;
+    for (int i = 0; i < translation->numTlbs; i++) visit(&translation->tlbs[i], arg);
+    if (translation->hasWalkCache) visit(&translation->walkCache, arg);
+}
+
+// Utility function to reset the counters of a cache (the end of a warmup).
+void resetCounters(cache_t *cache, void *arg) {
+    ulong *counters[MAX_COUNTERS];
+    int numCounters = cacheCounters(cache, counters);
+    for (int i = 0; i < numCounters; i++) *counters[i] = 0;
+}
+
+void saveCacheVisitor(cache_t *cache, void *arg) { saveCache((FILE *) arg, cache); }
+
+// Struct type to carry the file and the status of a checkpoint restore through forEachCache.
+typedef struct {
+    FILE *file;
+    int status;
+} restore_t;
+
+void loadCacheVisitor(cache_t *cache, void *arg) {
+    restore_t *restore = (restore_t *) arg;
+    if (!restore->status) restore->status = loadCache(restore->file, cache);
+}
+
+// Function to write a checkpoint of both runs after numAccesses accesses of a trace: every cache, the
+// prefetcher of the prefetching run and the translation counters. Returns 0 on success.
+int saveCheckpoint(const char *path, traceReader_t *trace, ulong numAccesses, hierarchy_t *runs, prefetcher_t *prefetcher, translation_t *translations) {
+    FILE *file = fopen(path, "wb");
+    if (!file) return 1;
+
+    ulong skip;
+    long offset = traceOffset(trace, &skip), description[4];
+    int version = CHECKPOINT_VERSION;
+    describeTrace(trace, description);
+    fwrite(CHECKPOINT_MAGIC, 1, 4, file);
+    fwrite(&version, sizeof(int), 1, file);
+    fwrite(description, sizeof(long), 4, file);
+    fwrite(&numAccesses, sizeof(ulong), 1, file);
+    fwrite(&offset, sizeof(long), 1, file);
+    fwrite(&skip, sizeof(ulong), 1, file);
+
+    for (int run = 0; run < 2; run++) {
+        forEachCache(&runs[run], translations ? &translations[run] : NULL, saveCacheVisitor, file);
+        // The four walk counters are consecutive fields of translation_t.
+        if (translations) fwrite(&translations[run].numWalks, sizeof(ulong), 4, file);
+    }
+    int shape[4] = {prefetcher->type - prefetcherTypes, prefetcher->tableSize, prefetcher->degree, prefetcher->distance};
+    fwrite(shape, sizeof(int), 4, file);
+    fwrite(prefetcher->table, sizeof(prefetchEntry_t), prefetcher->tableSize, file);
+    fwrite(&prefetcher->clock, sizeof(ulong), 1, file);
+
+    int status = ferror(file);
+    return fclose(file) || status;
+}
+
+// Function to restore both runs from a checkpoint and move the trace to where the checkpoint was taken.
+// Returns 0 on success.
+int loadCheckpoint(const char *path, traceReader_t *trace, ulong *numAccesses, hierarchy_t *runs, prefetcher_t *prefetcher, translation_t *translations) {
+    restore_t restore = {fopen(path, "rb"), 0};
+    if (!restore.file) return 1;
+
+    char magic[4];
+    int version, shape[4], expected[4] = {prefetcher->type - prefetcherTypes, prefetcher->tableSize, prefetcher->degree, prefetcher->distance};
+    long offset, description[4], traceDescription[4];
+    ulong skip;
+    describeTrace(trace, traceDescription);
+    if (fread(magic, 1, 4, restore.file) != 4 || memcmp(magic, CHECKPOINT_MAGIC, 4) || fread(&version, sizeof(int), 1, restore.file) != 1
+        || version != CHECKPOINT_VERSION || fread(description, sizeof(long), 4, restore.file) != 4
+        || memcmp(description, traceDescription, sizeof(description)) || fread(numAccesses, sizeof(ulong), 1, restore.file) != 1
+        || fread(&offset, sizeof(long), 1, restore.file) != 1 || fread(&skip, sizeof(ulong), 1, restore.file) != 1)
+        restore.status = 1;
+
+    for (int run = 0; run < 2 && !restore.status; run++) {
+        forEachCache(&runs[run], translations ? &translations[run] : NULL, loadCacheVisitor, &restore);
+        if (translations && !restore.status) restore.status = fread(&translations[run].numWalks, sizeof(ulong), 4, restore.file) != 4;
+    }
+    if (!restore.status)
+        restore.status = fread(shape, sizeof(int), 4, restore.file) != 4 || memcmp(shape, expected, sizeof(shape))
+                         || fread(prefetcher->table, sizeof(prefetchEntry_t), prefetcher->tableSize, restore.file) != (size_t) prefetcher->tableSize
+                         || fread(&prefetcher->clock, sizeof(ulong), 1, restore.file) != 1;
+    fclose(restore.file);
+    return restore.status || seekTrace(trace, offset, skip, *numAccesses);
+}
 
-// Function to initialize the cache.
-void initCache(cache_t *cache, int numSets, int numWays) {
-    cache->cache = (cacheLine_t ***) malloc(numSets * sizeof(cacheLine_t **));
-    for (int i = 0; i < numSets; i++) {
-        cache->cache[i] = (cacheLine_t **) malloc(numWays * sizeof(cacheLine_t *));
-        for (int j = 0; j < numWays; j++) {
-            cache->cache[i][j] = (cacheLine_t *) malloc(sizeof(cacheLine_t));
-            cache->cache[i][j]->valid = 0;
-            cache->cache[i][j]->tag = 0;
-            cache->cache[i][j]->relativeAge = 0;
-            cache->cache[i][j]->lastAccessed = 0;
-        }
+// Function to add the counters of a cache into another (used to merge the shards of a sharded run).
+void mergeCounters(cache_t *into, const cache_t *from) {
+    into->numHits += from->numHits;
+    into->numMisses += from->numMisses;
+    into->numMemReads += from->numMemReads;
+    into->numMemWrites += from->numMemWrites;
+    into->numWriteBacks += from->numWriteBacks;
+    into->numBackInvalidations += from->numBackInvalidations;
+    into->numPrefetches += from->numPrefetches;
+    into->numUsefulPrefetches += from->numUsefulPrefetches;
+    into->numUnusedPrefetches += from->numUnusedPrefetches;
+    into->numPollutionMisses += from->numPollutionMisses;
+}
+
+// Function to append a prefetch address to a message queue.
+void pushMessage(messageQueue_t *queue, ulong address) {
+    if (queue->count == queue->capacity) {
+        queue->capacity = queue->capacity ? 2 * queue->capacity : 64;
+        queue->addresses = (ulong *) realloc(queue->addresses, queue->capacity * sizeof(ulong));
     }
-    cache->numHits = 0;
-    cache->numMisses = 0;
-    cache->numMemReads = 0;
-    cache->numMemWrites = 0;
+    queue->addresses[queue->count++] = address;
 }
 
-// Utility function to calculate log base 2 of a number.
-int _log2(int n) {
-    int i = 0;
-    while (n >>= 1) i++;
-    return i;
+// Utility function to get the shard that owns the set of an address (shards own contiguous set ranges).
+int shardOf(shardedSim_t *sim, ulong address) {
+    return ((address >> sim->blockBits) & ((1UL << sim->setBits) - 1)) >> (sim->setBits - sim->shardBits);
 }
 
-// Function to process a memory access.
-void processTransaction(cache_t *cache, 
-                        int associativity, 
-                        int numSets, 
-                        ulong setIndex, 
-                        ulong tag, 
-                        ulong prefetchSetIndex, 
-                        ulong prefetchTag, 
-                        int isWrite, 
-                        int isFifo, 
-                        int prefetch, 
-                        FILE *debugFile) {
-    // Direct mapped cache.
-    if (associativity == 1) {
-        // Handle hits.
-        if (cache->cache[setIndex][0]->valid && cache->cache[setIndex][0]->tag == tag) {
-            if (debugFile) fprintf(debugFile, "Hit, ");
-
-            cache->numHits++;
-        }
-        // Handle misses.
-        else {
-            if (debugFile) fprintf(debugFile, "Miss, ");
-
-            // Increment the number of misses.
-            cache->numMisses++;
-            // Read the block from memory.
-            cache->numMemReads++;
-
-            cache->cache[setIndex][0]->valid = 1;
-            cache->cache[setIndex][0]->tag = tag;
-            cache->cache[setIndex][0]->relativeAge = 0;
-            cache->cache[setIndex][0]->lastAccessed = 0;
-
-            if (prefetch) {
-                // If the prefetching block is not in the cache, read it from memory and load it into the cache.
-                if (!cache->cache[prefetchSetIndex][0]->valid || cache->cache[prefetchSetIndex][0]->tag != prefetchTag) {
-                    cache->numMemReads++;
-
-                    cache->cache[prefetchSetIndex][0]->valid = 1;
-                    cache->cache[prefetchSetIndex][0]->tag = prefetchTag;
-                    cache->cache[prefetchSetIndex][0]->relativeAge = 0;
-                    cache->cache[prefetchSetIndex][0]->lastAccessed = 0;
-                }
+// Function run by each shard thread. Every epoch, a shard first applies the prefetches other shards sent
+// it during the previous epoch (in shard order, so runs are deterministic), then simulates its accesses
+// of the epoch in both runs.
+void *shardWorker(void *arg) {
+    shard_t *shard = (shard_t *) arg;
+    shardedSim_t *sim = shard->sim;
+
+    while (1) {
+        pthread_barrier_wait(&sim->start);
+        if (sim->done) break;
+
+        int parity = sim->epoch & 1;
+        for (int source = 0; source < sim->numShards; source++) {
+            messageQueue_t *queue = &sim->shards[source].outbox[!parity][shard->id];
+            for (unsigned long i = 0; i < queue->count; i++) issuePrefetch(&shard->caches[1], queue->addresses[i]);
+            queue->count = 0;
+        }
+
+        for (unsigned long i = 0; i < shard->numAccesses[parity]; i++) {
+            access_t *access = &shard->accesses[parity][i];
+            accessLevel(&shard->caches[0], access->address, access->isWrite);
+
+            int result = accessLevel(&shard->caches[1], access->address, access->isWrite);
+            ulong candidates[MAX_PREFETCH_DEGREE];
+            int numCandidates = shard->prefetcher.type->train(&shard->prefetcher, access->pc, access->address, sim->blockBits, result, candidates);
+            for (int j = 0; j < numCandidates; j++) {
+                int owner = shardOf(sim, candidates[j]);
+                if (owner == shard->id) issuePrefetch(&shard->caches[1], candidates[j]);
+                else pushMessage(&shard->outbox[parity][owner], candidates[j]);
             }
         }
 
-        // Write the block to memory if the access type is a write.
-        cache->numMemWrites += isWrite;
+        pthread_barrier_wait(&sim->end);
+    }
+    return NULL;
+}
 
-        return;
+// Function to decode the next epoch of the trace into the access buffers (of the given parity) of the
+// shards owning the accessed sets. Returns the number of accesses decoded.
+unsigned long decodeEpoch(traceReader_t *trace, shardedSim_t *sim, int parity) {
+    access_t access;
+    unsigned long decoded = 0;
+    for (int i = 0; i < sim->numShards; i++) sim->shards[i].numAccesses[parity] = 0;
+    while (decoded < SHARD_EPOCH && readAccess(trace, &access)) {
+        shard_t *shard = &sim->shards[shardOf(sim, access.address)];
+        shard->accesses[parity][shard->numAccesses[parity]++] = access;
+        decoded++;
     }
+    return decoded;
+}
 
-    // n-way set associative cache.
-    // Check if the address is in the cache.
-    int hitIndex = -1;
-    for (int i = 0; i < associativity; i++) {
-        cacheLine_t *line = cache->cache[setIndex][i];
-        if (line->valid && line->tag == tag) {
-            cache->numHits++;
-            hitIndex = i;
-            break;
+// Function to simulate the L1 data caches of both runs with their sets split across numShards threads.
+// The main thread decodes the next epoch of the trace and partitions it by set while the shards simulate
+// the current one. The shard counters are merged into the caches of the runs at the end. Returns the number
+// of accesses simulated.
+unsigned long runSharded(traceReader_t *trace, hierarchy_t *runs, const levelConfig_t *config, prefetcher_t *prefetcher, int numShards) {
+    shardedSim_t sim;
+    memset(&sim, 0, sizeof(sim));
+    sim.numShards = numShards;
+    sim.shardBits = _log2(numShards);
+    sim.blockBits = runs[0].levels[LEVEL_L1D]->blockBits;
+    sim.setBits = runs[0].levels[LEVEL_L1D]->setBits;
+    sim.shards = (shard_t *) calloc(numShards, sizeof(shard_t));
+    pthread_barrier_init(&sim.start, NULL, numShards + 1);
+    pthread_barrier_init(&sim.end, NULL, numShards + 1);
+
+    // Each shard owns 1 / numShards of the sets, so its caches are that much smaller. The tags of a shard
+    // keep the set bits that select the shard, so lines map back to the same addresses.
+    levelConfig_t shardConfig = *config;
+    shardConfig.cacheSize /= numShards;
+    for (int i = 0; i < numShards; i++) {
+        shard_t *shard = &sim.shards[i];
+        shard->id = i;
+        shard->sim = &sim;
+        for (int run = 0; run < 2; run++) {
+            initCache(&shard->caches[run], &shardConfig);
+            shard->caches[run].writeBack = runs[run].levels[LEVEL_L1D]->writeBack;
+            shard->caches[run].writeAllocate = runs[run].levels[LEVEL_L1D]->writeAllocate;
+            shard->accesses[run] = (access_t *) malloc(SHARD_EPOCH * sizeof(access_t));
         }
+        initPrefetcher(&shard->prefetcher, prefetcher->type, prefetcher->degree, prefetcher->distance, prefetcher->tableSize, &shard->caches[1]);
+        pthread_create(&shard->thread, NULL, shardWorker, shard);
     }
 
-    // Handle misses in the cache.
-    if (hitIndex == -1) {
-        // Debugging
-        if (debugFile) fprintf(debugFile, "MISS, ");
+    // Decode an epoch ahead of the shards. An epoch without accesses still runs to deliver the last messages.
+    unsigned long decoded = decodeEpoch(trace, &sim, 0), numAccesses = 0;
+    for (sim.epoch = 0; ; sim.epoch++) {
+        pthread_barrier_wait(&sim.start);
+        unsigned long next = decoded ? decodeEpoch(trace, &sim, !(sim.epoch & 1)) : 0;
+        pthread_barrier_wait(&sim.end);
+        if (!decoded) break;
+        numAccesses += decoded;
+        decoded = next;
+    }
 
-        // Increment the number of misses.
-        cache->numMisses++;
-        // Read the block from memory.
-        cache->numMemReads++;
-        // Check for an invalid line in the cache.
-        int lineId = -1;
-        for (int i = 0; i < associativity; i++)
-            if (!cache->cache[setIndex][i]->valid) {
-                lineId = i;
-                break;
-            }
+    sim.done = 1;
+    pthread_barrier_wait(&sim.start);
+    for (int i = 0; i < numShards; i++) {
+        shard_t *shard = &sim.shards[i];
+        pthread_join(shard->thread, NULL);
+        for (int run = 0; run < 2; run++) {
+            mergeCounters(runs[run].levels[LEVEL_L1D], &shard->caches[run]);
+            freeCache(&shard->caches[run]);
+            free(shard->accesses[run]);
+            for (int j = 0; j < numShards; j++) free(shard->outbox[run][j].addresses);
+        }
+        free(shard->prefetcher.table);
+    }
+    pthread_barrier_destroy(&sim.start);
+    pthread_barrier_destroy(&sim.end);
+    free(sim.shards);
+    return numAccesses;
+}
 
-        // If there is an invalid line, load the block into it.
-        if (lineId != -1) {
-            for (int i = 0; i < associativity; i++)
-                if (cache->cache[setIndex][i]->valid) {
-                    cache->cache[setIndex][i]->relativeAge++;
-                    cache->cache[setIndex][i]->lastAccessed++;
-                }
+// Function to snoop the caches of the other cores for a bus request of core id. A read request downgrades
+// the other copies to Shared, writing a Modified block back to the level below; an exclusive request (a
+// write miss or an upgrade) invalidates them. A Modified owner, or with MESI an Exclusive owner, supplies
+// the block to the requester. Returns the number of other copies, and sets *supplied if a cache supplied it.
+int snoopCores(core_t *cores, int numCores, int id, ulong address, int exclusive, int protocol, int *supplied) {
+    int numCopies = 0;
+    *supplied = 0;
+    for (int i = 0; i < numCores; i++) {
+        cache_t *cache = &cores[i].cache;
+        ulong setIndex = setIndexOf(cache, address);
+        int freeWay, way = findLine(cache, setIndex, tagOf(cache, address), &freeWay);
+        if (i == id || way < 0) continue;
 
-            cache->cache[setIndex][lineId]->valid = 1;
+        cacheLine_t *line = cache->lines + setIndex * cache->numWays + way;
+        numCopies++;
+        if (line->dirty || (protocol == COHERENCE_MESI && !line->shared)) {
+            *supplied = 1;
+            cores[i].numTransfers++;
+        }
+        if (exclusive) {
+            invalidateLine(cache, setIndex, way);
+            cores[i].numInvalidations++;
+            if (!findBlock(&cores[i].invalidated, address >> cache->blockBits)) insertBlock(&cores[i].invalidated, address >> cache->blockBits, 0);
         }
-        // If all lines in the cache set are valid, replace according to the replacement policy.
         else {
-            // Replace the cache line that was loaded least recently.
-            if (isFifo) {
-                // Find the cache line that was loaded least recently.
-                int maxAge = 0;
-                lineId = 0;
-                for (int i = 0; i < associativity; i++)
-                    if (cache->cache[setIndex][i]->relativeAge > maxAge) {
-                        maxAge = cache->cache[setIndex][i]->relativeAge;
-                        lineId = i;
-                    }
+            if (line->dirty) {
+                cache->numWriteBacks++;
+                writeBelow(cache, address);
             }
-            // Replace the cache line that was accessed least recently.
-            else {
-                // Find the cache line that was accessed least recently.
-                int oldestAccess = 0;
-                lineId = 0;
-                for (int i = 0; i < associativity; i++) {
-                    if (cache->cache[setIndex][i]->lastAccessed > oldestAccess) {
-                        oldestAccess = cache->cache[setIndex][i]->lastAccessed;
-                        lineId = i;
-                    }
-                }
+            line->dirty = 0;
+            line->shared = 1;
+        }
+    }
+    return numCopies;
+}
+
+// Function to process a memory access of core id in a multi-core simulation. Hits on Modified and Exclusive
+// lines (and read hits on Shared lines) stay local; writes to Shared lines upgrade them by invalidating the
+// other copies. Misses snoop the other caches and read the block from the level below unless a cache
+// supplied it. Write misses take the block in the Modified state.
+void coherentAccess(core_t *cores, int numCores, int id, ulong address, int isWrite, int protocol) {
+    core_t *core = &cores[id];
+    cache_t *cache = &core->cache;
+    ulong setIndex = setIndexOf(cache, address), block = address >> cache->blockBits;
+    int freeWay, way = findLine(cache, setIndex, tagOf(cache, address), &freeWay), supplied;
+
+    if (way >= 0) {
+        cacheLine_t *line = cache->lines + setIndex * cache->numWays + way;
+        cache->numHits++;
+        cache->policy->onHit(cache, setIndex, way);
+        if (isWrite && line->shared) {
+            snoopCores(cores, numCores, id, address, 1, protocol, &supplied);
+            core->numUpgrades++;
+            line->shared = 0;
+        }
+        if (isWrite) line->dirty = 1;
+        return;
+    }
+
+    cache->numMisses++;
+    cache->policy->onMiss(cache, setIndex);
+    if (findBlock(&core->invalidated, block)) {
+        core->numCoherenceMisses++;
+        removeBlock(&core->invalidated, block);
+    }
+
+    int numCopies = snoopCores(cores, numCores, id, address, isWrite, protocol, &supplied);
+    if (!supplied) {
+        cache->numMemReads++;
+        if (cache->next) accessLevel(cache->next, address, 0);
+    }
+    installLine(cache, address, isWrite, 0);
+    way = findLine(cache, setIndex, tagOf(cache, address), &freeWay);
+    cache->lines[setIndex * cache->numWays + way].shared = !isWrite && (numCopies || protocol == COHERENCE_MSI);
+}
+
+// Function to simulate numCores cores, each running its own trace (paths is a comma separated list), with
+// private write-back L1 data caches kept coherent by snooping over the shared lower levels of configs.
+// Accesses of the cores are interleaved round robin. Returns 0 on success.
+int runCoherent(const char *paths, const levelConfig_t *configs, int protocol, int writeBufferSize) {
+    char *dup = strdup(paths), *rest = dup, *path;
+    core_t *cores = (core_t *) calloc(MAX_CORES, sizeof(core_t));
+    int numCores = 0, status = 0;
+    while (!status && (path = strsep(&rest, ","))) {
+        if (numCores == MAX_CORES) {
+            printf("At most %d cores are supported\n", MAX_CORES);
+            status = 1;
+        }
+        else if (openTrace(&cores[numCores].trace, path)) {
+            printf("Could not open trace file %s\n", path);
+            status = 1;
+        }
+        else numCores++;
+    }
+
+    // The shared levels form a hierarchy of their own below the private caches.
+    levelConfig_t sharedConfigs[MAX_LEVELS];
+    memcpy(sharedConfigs, configs, sizeof(sharedConfigs));
+    sharedConfigs[LEVEL_L1D].cacheSize = sharedConfigs[LEVEL_L1I].cacheSize = 0;
+    hierarchy_t shared;
+    initHierarchy(&shared, sharedConfigs, NON_INCLUSIVE, writeBufferSize);
+    cache_t *below = shared.levels[LEVEL_L2] ? shared.levels[LEVEL_L2] : shared.levels[LEVEL_L3];
+
+    levelConfig_t privateConfig = configs[LEVEL_L1D];
+    privateConfig.writeBack = privateConfig.writeAllocate = 1;
+    for (int i = 0; i < numCores; i++) {
+        initCache(&cores[i].cache, &privateConfig);
+        cores[i].cache.next = below;
+        if (!below && writeBufferSize) {
+            cores[i].cache.writeBuffer.size = writeBufferSize;
+            cores[i].cache.writeBuffer.entries = (ulong *) malloc(writeBufferSize * sizeof(ulong));
+        }
+        initBlockTable(&cores[i].invalidated, 1024);
+    }
+
+    // Each round gives every core that has not finished its trace one access.
+    access_t access;
+    for (int active = !status; active; ) {
+        active = 0;
+        for (int i = 0; i < numCores; i++)
+            if (readAccess(&cores[i].trace, &access)) {
+                coherentAccess(cores, numCores, i, access.address, access.isWrite, protocol);
+                active = 1;
             }
+    }
+    for (int i = 0; i < numCores && !status; i++)
+        if (cores[i].trace.error) {
+            printf("Corrupt trace file\n");
+            status = 1;
+        }
 
-            // Update the relative last accessed times and relative ages of all cache lines in the set.
-            for (int i = 0; i < associativity; i++)
-                if (i != lineId) {
-                    cache->cache[setIndex][i]->relativeAge++;
-                    cache->cache[setIndex][i]->lastAccessed++;
-                }
-        }
-
-        // Replace the cache line.
-        cache->cache[setIndex][lineId]->tag = tag;
-        cache->cache[setIndex][lineId]->relativeAge = 0;
-        cache->cache[setIndex][lineId]->lastAccessed = 0;
-
-        // Prefetching
-        if (prefetch) {
-            hitIndex = -1;
-            for (int i = 0; i < associativity; i++)
-                if (cache->cache[prefetchSetIndex][i]->valid && cache->cache[prefetchSetIndex][i]->tag == prefetchTag) {
-                    hitIndex = i;
-                    break;
-                }
-
-            // If it's not in the cache, load it into the cache.
-            if (hitIndex == -1) {
-                cache->numMemReads++;
-
-                // Check for an invalid line in the cache.
-                lineId = -1;
-                for (int i = 0; i < associativity; i++) {
-                    if (!cache->cache[prefetchSetIndex][i]->valid) {
-                        lineId = i;
-                        break;
-                    }
-                }
-
-                // If there is an invalid line, load the block into it.
-                if (lineId != -1) {
-                    cache->cache[prefetchSetIndex][lineId]->tag = prefetchTag;
-
-                    for (int i = 0; i < associativity; i++)
-                        if (cache->cache[prefetchSetIndex][i]->valid) {
-                            cache->cache[prefetchSetIndex][i]->relativeAge++;
-                            cache->cache[prefetchSetIndex][i]->lastAccessed++;
-                        }
-
-                    cache->cache[prefetchSetIndex][lineId]->valid = 1;
-                }
-                // If all lines in the cache set are valid, replace according to the replacement policy.
-                else {
-                    // Replace the cache line that was loaded least recently.
-                    if (isFifo) {
-                        // Find the cache line that was loaded least recently.
-                        int maxAge = 0;
-                        lineId = 0;
-                        for (int i = 0; i < associativity; i++) {
-                            if (cache->cache[prefetchSetIndex][i]->relativeAge > maxAge) {
-                                maxAge = cache->cache[prefetchSetIndex][i]->relativeAge;
-                                lineId = i;
-                            }
-                        }
-                    }
-                    // Replace the cache line that was accessed least recently.
-                    else {
-                        // Find the cache line that was accessed least recently.
-                        int oldestAccess = 0;
-                        lineId = 0;
-                        for (int i = 0; i < associativity; i++) {
-                            if (cache->cache[prefetchSetIndex][i]->lastAccessed > oldestAccess) {
-                                oldestAccess = cache->cache[prefetchSetIndex][i]->lastAccessed;
-                                lineId = i;
-                            }
-                        }
-                    }
-
-                    // Update the relative last accessed times and relative ages of all cache lines in the set.
-                    for (int i = 0; i < associativity; i++)
-                        if (i != lineId) {
-                            cache->cache[prefetchSetIndex][i]->relativeAge++;
-                            cache->cache[prefetchSetIndex][i]->lastAccessed++;
-                        }
-                }
-
-                // Replace the cache line.
-                cache->cache[prefetchSetIndex][lineId]->tag = prefetchTag;
-                cache->cache[prefetchSetIndex][lineId]->relativeAge = 0;
-                cache->cache[prefetchSetIndex][lineId]->lastAccessed = 0;
+    if (!status) {
+        ulong memReads = 0, memWrites = 0, hits = 0, misses = 0, totals[4] = {0};
+        printf("Cores: %d, protocol: %s\n", numCores, protocol == COHERENCE_MESI ? "MESI" : "MSI");
+        for (int i = 0; i < numCores; i++) {
+            cache_t *cache = &cores[i].cache;
+            printf("Core %d hits: %lu, misses: %lu, coherence misses: %lu, invalidations: %lu, upgrades: %lu, "
+                   "cache-to-cache transfers: %lu, write-backs: %lu\n", i, cache->numHits, cache->numMisses,
+                   cores[i].numCoherenceMisses, cores[i].numInvalidations, cores[i].numUpgrades, cores[i].numTransfers, cache->numWriteBacks);
+            hits += cache->numHits;
+            misses += cache->numMisses;
+            totals[0] += cores[i].numCoherenceMisses;
+            totals[1] += cores[i].numInvalidations;
+            totals[2] += cores[i].numUpgrades;
+            totals[3] += cores[i].numTransfers;
+            if (!below) {
+                memReads += cache->numMemReads;
+                memWrites += cache->numMemWrites - cache->writeBuffer.numCoalesced;
             }
         }
+        for (int i = 0; i < MAX_LEVELS; i++)
+            if (shared.levels[i] && !shared.levels[i]->next) {
+                memReads += shared.levels[i]->numMemReads;
+                memWrites += shared.levels[i]->numMemWrites - shared.levels[i]->writeBuffer.numCoalesced;
+            }
+
+        printf("Memory reads: %lu\n", memReads);
+        printf("Memory writes: %lu\n", memWrites);
+        printf("Cache hits: %lu\n", hits);
+        printf("Cache misses: %lu\n", misses);
+        printf("Coherence misses: %lu, invalidations: %lu, upgrades: %lu, cache-to-cache transfers: %lu\n", totals[0], totals[1], totals[2], totals[3]);
+        printHierarchy(&shared, NULL);
+    }
+
+    for (int i = 0; i < numCores; i++) {
+        closeTrace(&cores[i].trace);
+        freeCache(&cores[i].cache);
+        freeBlockTable(&cores[i].invalidated);
+    }
+    freeHierarchy(&shared);
+    free(cores);
+    free(dup);
+    return status;
+}
+
+// Function to choose numSets / ratio of the sets of a cache uniformly at random (a partial Fisher-Yates
+// shuffle seeded with seed), so that the sample does not alias with strided access patterns.
+void initSampler(setSampler_t *sampler, cache_t *cache, int ratio, ulong seed) {
+    memset(sampler, 0, sizeof(*sampler));
+    sampler->numSets = cache->numSets;
+    sampler->numSampled = cache->numSets / ratio;
+    sampler->sampled = (unsigned char *) calloc(cache->numSets, 1);
+    sampler->accesses = (ulong *) calloc(cache->numSets, sizeof(ulong));
+    sampler->misses[0] = (ulong *) calloc(cache->numSets, sizeof(ulong));
+    sampler->misses[1] = (ulong *) calloc(cache->numSets, sizeof(ulong));
+
+    int *order = (int *) malloc(cache->numSets * sizeof(int));
+    for (int i = 0; i < cache->numSets; i++) order[i] = i;
+    ulong rng = seed ? seed : 1;
+    for (int i = 0; i < sampler->numSampled; i++) {
+        int j = i + xorshift(&rng) % (cache->numSets - i), chosen = order[j];
+        order[j] = order[i];
+        order[i] = chosen;
+        sampler->sampled[chosen] = 1;
+    }
+    free(order);
+}
+
+// Function to free the buffers of a set sampler.
+void freeSampler(setSampler_t *sampler) {
+    free(sampler->sampled);
+    free(sampler->accesses);
+    free(sampler->misses[0]);
+    free(sampler->misses[1]);
+}
+
+// Function to estimate the miss ratio of a run from the sampled sets (a ratio estimator over the sets).
+// Returns the half width of its 95% confidence interval, corrected for sampling without replacement.
+double missRatioInterval(const setSampler_t *sampler, int run, double *missRatio) {
+    ulong misses = 0;
+    for (int i = 0; i < sampler->numSets; i++) misses += sampler->misses[run][i];
+    *missRatio = sampler->numSampledAccesses ? (double) misses / sampler->numSampledAccesses : 0.0;
+    if (sampler->numSampled < 2 || !sampler->numSampledAccesses) return 0.0;
+
+    double sumSquares = 0.0, meanAccesses = (double) sampler->numSampledAccesses / sampler->numSampled;
+    for (int i = 0; i < sampler->numSets; i++)
+        if (sampler->sampled[i]) {
+            double residual = sampler->misses[run][i] - *missRatio * sampler->accesses[i];
+            sumSquares += residual * residual;
+        }
+    double variance = (1.0 - (double) sampler->numSampled / sampler->numSets) * sumSquares
+                      / ((sampler->numSampled - 1) * sampler->numSampled * meanAccesses * meanAccesses);
+    return 1.96 * sqrt(variance);
+}
+
+// Utility functions to update a Fenwick tree and to sum its positions 0 to pos - 1.
+void fenwickAdd(int *tree, ulong size, ulong pos, int delta) {
+    for (pos++; pos <= size; pos += pos & -pos) tree[pos - 1] += delta;
+}
+
+ulong fenwickSum(const int *tree, ulong pos) {
+    ulong sum = 0;
+    for (; pos; pos -= pos & -pos) sum += tree[pos - 1];
+    return sum;
+}
+
+// Function to renumber the last access times of the tracked blocks to 0, 1, ... in the same order,
+// and rebuild the Fenwick tree from them.
+void compactReuse(reuseAnalysis_t *analysis) {
+    ulong size = 2UL * analysis->maxBlocks;
+    int *byTime = (int *) malloc(size * sizeof(int));
+    for (ulong i = 0; i < size; i++) byTime[i] = -1;
+    for (int i = 0; i < analysis->numBlocks; i++) byTime[analysis->entries[i].lastTime] = i;
+
+    memset(analysis->fenwick, 0, size * sizeof(int));
+    analysis->time = 0;
+    for (ulong i = 0; i < size; i++)
+        if (byTime[i] >= 0) {
+            analysis->entries[byTime[i]].lastTime = analysis->time;
+            fenwickAdd(analysis->fenwick, size, analysis->time++, 1);
+        }
+    free(byTime);
+}
+
+// Function to halve the sampling rate of a reuse analysis (the threshold stays at least 1) and drop the
+// blocks that are no longer sampled.
+void purgeReuse(reuseAnalysis_t *analysis) {
+    if (analysis->threshold > 1) analysis->threshold /= 2;
+    memset(analysis->blocks.keys, 0, (analysis->blocks.mask + 1) * sizeof(ulong));
+    analysis->blocks.count = 0;
+    int kept = 0;
+    for (int i = 0; i < analysis->numBlocks; i++) {
+        reuseEntry_t *entry = &analysis->entries[i];
+        if ((mixHash(entry->block) & (REUSE_HASH_RANGE - 1)) >= analysis->threshold) continue;
+        analysis->entries[kept] = *entry;
+        insertBlock(&analysis->blocks, entry->block, kept++);
+    }
+    analysis->numBlocks = kept;
+    compactReuse(analysis);
+}
+
+// Function to swap two counters of the hottest blocks heap and update the table that locates them.
+void swapHot(reuseAnalysis_t *analysis, int i, int j) {
+    hotBlock_t hot = analysis->hotBlocks[i];
+    analysis->hotBlocks[i] = analysis->hotBlocks[j];
+    analysis->hotBlocks[j] = hot;
+    *findBlock(&analysis->hot, analysis->hotBlocks[i].block) = i;
+    *findBlock(&analysis->hot, analysis->hotBlocks[j].block) = j;
+}
+
+// Function to count an access to a block in the space-saving sketch of the hottest blocks. The counters
+// form a min-heap, so a block that is not tracked replaces the least counted one in O(log maxHot).
+void countHotBlock(reuseAnalysis_t *analysis, ulong block) {
+    int *found = findBlock(&analysis->hot, block), i;
+    if (found) {
+        i = *found;
+        analysis->hotBlocks[i].count++;
+    }
+    else if (analysis->numHot < analysis->maxHot) {
+        i = analysis->numHot++;
+        analysis->hotBlocks[i] = (hotBlock_t) {block, 1, 0};
+        insertBlock(&analysis->hot, block, i);
+        for (; i && analysis->hotBlocks[(i - 1) / 2].count > analysis->hotBlocks[i].count; i = (i - 1) / 2) swapHot(analysis, i, (i - 1) / 2);
+        return;
     }
-    // Handle hits in the cache.
     else {
-        // Debugging.
-        if (debugFile) fprintf(debugFile, "HIT, ");
+        i = 0;
+        removeBlock(&analysis->hot, analysis->hotBlocks[0].block);
+        analysis->hotBlocks[0] = (hotBlock_t) {block, analysis->hotBlocks[0].count + 1, analysis->hotBlocks[0].count};
+        insertBlock(&analysis->hot, block, 0);
+    }
 
-        cache->cache[setIndex][hitIndex]->lastAccessed = 0;
-        for (int i = 0; i < associativity; i++)
-            if (i != hitIndex) cache->cache[setIndex][i]->lastAccessed++;
+    while (1) {
+        int smallest = i, left = 2 * i + 1, right = left + 1;
+        if (left < analysis->numHot && analysis->hotBlocks[left].count < analysis->hotBlocks[smallest].count) smallest = left;
+        if (right < analysis->numHot && analysis->hotBlocks[right].count < analysis->hotBlocks[smallest].count) smallest = right;
+        if (smallest == i) break;
+        swapHot(analysis, i, smallest);
+        i = smallest;
     }
+}
 
-    // Write the block to memory if the access type is a write.
-    cache->numMemWrites += isWrite;
+// Function to record the working set size of the current time window.
+void closeWindow(reuseAnalysis_t *analysis) {
+    if (!analysis->numWindows || analysis->windowBlocks < analysis->minWorkingSet) analysis->minWorkingSet = analysis->windowBlocks;
+    if (analysis->windowBlocks > analysis->maxWorkingSet) analysis->maxWorkingSet = analysis->windowBlocks;
+    analysis->sumWorkingSet += analysis->windowBlocks;
+    analysis->numWindows++;
+    analysis->window++;
+    analysis->windowBlocks = 0;
+}
 
-    // Debugging.
-    if (debugFile) {
-        for (int i = 0; i < numSets; i++) {
-            for (int j = 0; j < associativity; j++) {
-                if (cache->cache[i][j]->valid)
-                    fprintf(debugFile, "%lx(%d)", cache->cache[i][j]->tag, cache->cache[i][j]->lastAccessed);
-                else fprintf(debugFile, "-");
-                if (j != associativity - 1) fprintf(debugFile, " + ");
-            }
-            fprintf(debugFile, " | ");
+// Function to add an access to a reuse analysis. Sampled blocks count with the inverse of the sampling rate.
+void analyzeAccess(reuseAnalysis_t *analysis, ulong address) {
+    if (analysis->numAccesses && analysis->numAccesses % analysis->windowSize == 0) closeWindow(analysis);
+    analysis->numAccesses++;
+
+    ulong block = address >> analysis->blockBits, size = 2UL * analysis->maxBlocks;
+    countHotBlock(analysis, block);
+    if ((mixHash(block) & (REUSE_HASH_RANGE - 1)) >= analysis->threshold) return;
+
+    if (analysis->time == size) compactReuse(analysis);
+    int *found = findBlock(&analysis->blocks, block);
+    // A purge may drop no block, so the sampling rate halves until one is free. A block that no longer fits
+    // at the lowest sampling rate is not tracked.
+    while (!found && analysis->numBlocks == analysis->maxBlocks) {
+        if (analysis->threshold == 1) return;
+        purgeReuse(analysis);
+        if ((mixHash(block) & (REUSE_HASH_RANGE - 1)) >= analysis->threshold) return;
+    }
+
+    double weight = (double) REUSE_HASH_RANGE / analysis->threshold;
+    reuseEntry_t *entry;
+    if (found) {
+        entry = &analysis->entries[*found];
+        ulong distance = (fenwickSum(analysis->fenwick, analysis->time) - fenwickSum(analysis->fenwick, entry->lastTime + 1)) * weight;
+        int bucket = 0;
+        while (distance >> bucket && bucket < REUSE_BUCKETS - 1) bucket++;
+        analysis->histogram[bucket] += weight;
+        fenwickAdd(analysis->fenwick, size, entry->lastTime, -1);
+        if (entry->lastWindow != analysis->window) analysis->windowBlocks += weight;
+    }
+    else {
+        entry = &analysis->entries[analysis->numBlocks];
+        entry->block = block;
+        insertBlock(&analysis->blocks, block, analysis->numBlocks++);
+        analysis->cold += weight;
+        analysis->windowBlocks += weight;
+    }
+    entry->lastTime = analysis->time;
+    entry->lastWindow = analysis->window;
+    fenwickAdd(analysis->fenwick, size, analysis->time++, 1);
+}
+
+// Utility function to order hot block counters by decreasing count.
+int compareHotBlocks(const void *a, const void *b) {
+    const hotBlock_t *x = (const hotBlock_t *) a, *y = (const hotBlock_t *) b;
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+// Function to compute, in one pass over a trace, the reuse distance histogram (and the hit ratios of
+// fully associative LRU caches it implies), the working set size per window of accesses and the hottest
+// blocks. Memory is bounded by maxBlocks tracked blocks; sampleRatio samples 1 in sampleRatio blocks
+// from the start. Returns 0 on success.
+int analyzeTrace(const char *path, int blockSize, int sampleRatio, int maxBlocks, ulong windowSize, int numTop) {
+    traceReader_t trace;
+    if (openTrace(&trace, path)) {
+        printf("Could not open trace file\n");
+        return 1;
+    }
+
+    reuseAnalysis_t analysis;
+    memset(&analysis, 0, sizeof(analysis));
+    analysis.blockBits = _log2(blockSize);
+    analysis.maxBlocks = maxBlocks;
+    analysis.threshold = REUSE_HASH_RANGE / sampleRatio;
+    analysis.windowSize = windowSize;
+    analysis.maxHot = numTop * 16 > 1024 ? numTop * 16 : 1024;
+    unsigned long capacity = 1;
+    while (capacity < 2UL * maxBlocks) capacity *= 2;
+    initBlockTable(&analysis.blocks, capacity);
+    for (capacity = 1; capacity < 2UL * analysis.maxHot; capacity *= 2);
+    initBlockTable(&analysis.hot, capacity);
+    analysis.entries = (reuseEntry_t *) malloc(maxBlocks * sizeof(reuseEntry_t));
+    analysis.hotBlocks = (hotBlock_t *) malloc(analysis.maxHot * sizeof(hotBlock_t));
+    analysis.fenwick = (int *) calloc(2UL * maxBlocks, sizeof(int));
+
+    access_t access;
+    while (readAccess(&trace, &access)) analyzeAccess(&analysis, access.address);
+    // The last window only counts if it is complete (or the only one).
+    if (analysis.numAccesses % windowSize == 0 || !analysis.numWindows) closeWindow(&analysis);
+
+    int status = trace.error;
+    if (status) printf("Corrupt trace file\n");
+    else {
+        printf("Accesses: %lu, sampling rate: 1/%lu\n", analysis.numAccesses, REUSE_HASH_RANGE / analysis.threshold);
+        printf("Distinct blocks: %.0f\n", analysis.cold);
+
+        // A fully associative LRU cache of 2^i blocks hits exactly the accesses with a reuse distance below 2^i.
+        printf("Reuse distance histogram (distinct blocks since the previous access to the block):\n");
+        double hits = 0;
+        int last = REUSE_BUCKETS - 1;
+        while (last && !analysis.histogram[last]) last--;
+        for (int i = 0; i <= last; i++) {
+            hits += analysis.histogram[i];
+            if (i > 1) printf("  %lu-%lu: %.0f", 1UL << (i - 1), (1UL << i) - 1, analysis.histogram[i]);
+            else printf("  %d: %.0f", i, analysis.histogram[i]);
+            printf(", LRU hit ratio with %lu blocks (%lu bytes): %.2f%%\n", 1UL << i, (ulong) blockSize << i,
+                   analysis.numAccesses ? 100.0 * hits / analysis.numAccesses : 0.0);
+        }
+        printf("  cold: %.0f\n", analysis.cold);
+
+        printf("Working set (blocks per %lu accesses): min %.0f, mean %.0f, max %.0f (%.0f bytes)\n", windowSize,
+               analysis.minWorkingSet, analysis.sumWorkingSet / analysis.numWindows, analysis.maxWorkingSet, analysis.maxWorkingSet * blockSize);
+
+        qsort(analysis.hotBlocks, analysis.numHot, sizeof(hotBlock_t), compareHotBlocks);
+        printf("Hottest blocks (accesses, overestimated by at most the error):\n");
+        for (int i = 0; i < numTop && i < analysis.numHot; i++)
+            printf("  %lx: %lu (error %lu)\n", analysis.hotBlocks[i].block << analysis.blockBits, analysis.hotBlocks[i].count, analysis.hotBlocks[i].error);
+    }
+
+    closeTrace(&trace);
+    freeBlockTable(&analysis.blocks);
+    freeBlockTable(&analysis.hot);
+    free(analysis.entries);
+    free(analysis.hotBlocks);
+    free(analysis.fenwick);
+    return status;
+}
+
+// Function to add up the memory traffic of a hierarchy (the traffic of the levels that talk to memory).
+void memoryTraffic(hierarchy_t *hierarchy, ulong *reads, ulong *writes, ulong *coalesced) {
+    *reads = *writes = *coalesced = 0;
+    for (int i = 0; i < MAX_LEVELS; i++)
+        if (hierarchy->levels[i] && !hierarchy->levels[i]->next) {
+            *reads += hierarchy->levels[i]->numMemReads;
+            *writes += hierarchy->levels[i]->numMemWrites;
+            *coalesced += hierarchy->levels[i]->writeBuffer.numCoalesced;
+        }
+    *writes -= *coalesced;
+}
+
+// Function to assign the current interval to a phase. Returns the phase, or -1 once MAX_PHASES are in use.
+int detectPhase(intervalStats_t *intervals) {
+    double vector[PHASE_DIMENSIONS], total = 0;
+    for (int i = 0; i < PHASE_DIMENSIONS; i++) total += intervals->vector[i];
+    for (int i = 0; i < PHASE_DIMENSIONS; i++) vector[i] = total ? intervals->vector[i] / total : 0.0;
+
+    int phase = -1;
+    double best = PHASE_THRESHOLD;
+    for (int p = 0; p < intervals->numPhases; p++) {
+        double distance = 0;
+        for (int i = 0; i < PHASE_DIMENSIONS; i++) distance += fabs(vector[i] - intervals->phases[p][i]);
+        if (distance < best) {
+            best = distance;
+            phase = p;
+        }
+    }
+    if (phase < 0 && intervals->numPhases < MAX_PHASES) {
+        phase = intervals->numPhases++;
+        memcpy(intervals->phases[phase], vector, sizeof(vector));
+        intervals->phaseRepresentatives[phase] = intervals->index;
+    }
+    if (phase >= 0) intervals->phaseIntervals[phase]++;
+    memset(intervals->vector, 0, sizeof(intervals->vector));
+    return phase;
+}
+
+// Function to write the statistics of both runs for the interval that just ended, as the difference
+// between the counters now and at the end of the previous interval.
+void emitInterval(intervalStats_t *intervals, hierarchy_t *runs, ulong numAccesses) {
+    int phase = detectPhase(intervals);
+    for (int run = 0; run < 2; run++) {
+        cache_t *l1d = runs[run].levels[LEVEL_L1D];
+        ulong counters[6], delta[6], coalesced;
+        counters[0] = l1d->numHits;
+        counters[1] = l1d->numMisses;
+        memoryTraffic(&runs[run], &counters[2], &counters[3], &coalesced);
+        counters[4] = l1d->numPrefetches;
+        counters[5] = l1d->numUsefulPrefetches;
+        for (int i = 0; i < 6; i++) {
+            delta[i] = counters[i] - intervals->last[run][i];
+            intervals->last[run][i] = counters[i];
+        }
+        double hitRate = delta[0] + delta[1] ? (double) delta[0] / (delta[0] + delta[1]) : 0.0;
+
+        if (intervals->json)
+            fprintf(intervals->file, "{\"interval\": %lu, \"accesses\": %lu, \"prefetch\": %d, \"hit_rate\": %.6f, \"hits\": %lu, "
+                    "\"misses\": %lu, \"memory_reads\": %lu, \"memory_writes\": %lu, \"prefetches\": %lu, \"useful_prefetches\": %lu, "
+                    "\"phase\": %d}\n", intervals->index, numAccesses, run, hitRate, delta[0], delta[1], delta[2], delta[3], delta[4], delta[5], phase);
+        else
+            fprintf(intervals->file, "%lu,%lu,%d,%.6f,%lu,%lu,%lu,%lu,%lu,%lu,%d\n", intervals->index, numAccesses, run, hitRate,
+                    delta[0], delta[1], delta[2], delta[3], delta[4], delta[5], phase);
+    }
+    intervals->index++;
+    intervals->count = 0;
+}
+
+// Function to parse the latencies of the timing model ("<L1>,<L2>,<L3>,<memory>" in cycles). Returns 1 on success.
+int parseLatencies(int *latencies, const char *spec) {
+    char *dup = strdup(spec), *rest = dup, *field;
+    int numFields = 0, valid = 1;
+    while ((field = strsep(&rest, ","))) {
+        if (numFields < 4 && atoi(field) > 0) latencies[numFields] = atoi(field);
+        else valid = 0;
+        numFields++;
+    }
+    free(dup);
+    return valid && numFields == 4;
+}
+
+// Function to allocate an empty miss profile. Regions are 2^regionBits bytes; PC profiles use 0.
+void initProfile(profile_t *profile, int maxEntries, int regionBits) {
+    initBlockTable(&profile->table, 1024);
+    profile->entries = (profileEntry_t *) malloc(maxEntries * sizeof(profileEntry_t));
+    profile->heap = (int *) malloc(maxEntries * sizeof(int));
+    profile->heapIndex = (int *) malloc(maxEntries * sizeof(int));
+    profile->numEntries = profile->full = 0;
+    profile->maxEntries = maxEntries;
+    profile->regionBits = regionBits;
+}
+
+// Function to free the buffers of a miss profile.
+void freeProfile(profile_t *profile) {
+    freeBlockTable(&profile->table);
+    free(profile->entries);
+    free(profile->heap);
+    free(profile->heapIndex);
+}
+
+// Function to move the entry at index i of the heap of a miss profile down to its place.
+void siftProfile(profile_t *profile, int i) {
+    int *heap = profile->heap;
+    while (1) {
+        int smallest = i, left = 2 * i + 1, right = left + 1;
+        if (left < profile->numEntries && profile->entries[heap[left]].misses[0] < profile->entries[heap[smallest]].misses[0]) smallest = left;
+        if (right < profile->numEntries && profile->entries[heap[right]].misses[0] < profile->entries[heap[smallest]].misses[0]) smallest = right;
+        if (smallest == i) break;
+        int entry = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = entry;
+        profile->heapIndex[heap[i]] = i;
+        profile->heapIndex[entry] = smallest;
+        i = smallest;
+    }
+}
+
+// Function to count an access in a miss profile: whether it missed in the runs without and with
+// prefetching, and the memory reads and writes it caused.
+void countProfile(profile_t *profile, ulong key, int miss, int prefetchMiss, ulong memReads, ulong memWrites) {
+    int *found, i;
+    key >>= profile->regionBits;
+    if (profile->numEntries && key == profile->lastKey) i = profile->lastIndex;
+    else if ((found = findBlock(&profile->table, key))) i = *found;
+    else if (profile->numEntries < profile->maxEntries) {
+        i = profile->numEntries++;
+        profile->entries[i] = (profileEntry_t) {key};
+        insertBlock(&profile->table, key, i);
+    }
+    else if (!miss && !prefetchMiss) return;
+    else {
+        // The heap is only needed once the profile is full.
+        if (!profile->full) {
+            profile->full = 1;
+            for (int j = 0; j < profile->numEntries; j++) profile->heap[j] = profile->heapIndex[j] = j;
+            for (int j = profile->numEntries / 2 - 1; j >= 0; j--) siftProfile(profile, j);
         }
-        fprintf(debugFile, ", MemReads: %d, MemWrites: %d\n", cache->numMemReads, cache->numMemWrites);
+        i = profile->heap[0];
+        ulong error = profile->entries[i].misses[0];
+        removeBlock(&profile->table, profile->entries[i].key);
+        profile->entries[i] = (profileEntry_t) {key, 0, {error, error}, 0, 0, error};
+        insertBlock(&profile->table, key, i);
+    }
+
+    profile->lastKey = key;
+    profile->lastIndex = i;
+    profileEntry_t *entry = &profile->entries[i];
+    entry->accesses++;
+    entry->misses[0] += miss;
+    entry->misses[1] += prefetchMiss;
+    entry->memReads += memReads;
+    entry->memWrites += memWrites;
+    if (miss && profile->full) siftProfile(profile, profile->heapIndex[i]);
+}
+
+// Utility function to order profile entries by decreasing misses.
+int compareProfileEntries(const void *a, const void *b) {
+    const profileEntry_t *x = (const profileEntry_t *) a, *y = (const profileEntry_t *) b;
+    return x->misses[0] < y->misses[0] ? 1 : x->misses[0] > y->misses[0] ? -1 : 0;
+}
+
+// Function to print the numTop entries of a miss profile with the most misses. Prefetching saves the
+// misses of the run without prefetching that the prefetching run does not have (negative if it pollutes).
+// The miss rate of an entry that replaced another one covers the accesses since then.
+void printProfile(profile_t *profile, const char *name, int numTop) {
+    qsort(profile->entries, profile->numEntries, sizeof(profileEntry_t), compareProfileEntries);
+    printf("Top %ss by misses (%d tracked):\n", name, profile->numEntries);
+    printf("  %-18s %12s %12s %9s %12s %12s %14s %10s\n", name, "accesses", "misses", "miss rate", "mem reads", "mem writes",
+           "prefetch saved", "error");
+    for (int i = 0; i < numTop && i < profile->numEntries; i++) {
+        profileEntry_t *entry = &profile->entries[i];
+        printf("  %#-18lx %12lu %12lu %8.2f%% %12lu %12lu %14ld %10lu\n", entry->key << profile->regionBits, entry->accesses,
+               entry->misses[0], entry->accesses ? 100.0 * (entry->misses[0] - entry->error) / entry->accesses : 0.0, entry->memReads,
+               entry->memWrites, (long) (entry->misses[0] - entry->misses[1]), entry->error);
     }
 }
 
+// Function to print the timing statistics of a run: AMAT, memory bus use, MSHR stalls and the latency histogram.
+void printTiming(const timingModel_t *timing, int blockSize, int prefetch) {
+    ulong numAccesses = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) numAccesses += timing->histogram[i];
+    ulong cycles = timing->end > timing->now ? timing->end : timing->now;
+    printf("Cycles: %lu, AMAT: %.2f cycles\n", cycles, numAccesses ? (double) timing->totalLatency / numAccesses : 0.0);
+    printf("Memory bandwidth: %.2f bytes/cycle, bus utilization: %.2f%%, MSHR stalls: %lu (%lu cycles)\n",
+           cycles ? (double) timing->busBusy / timing->transferCycles * blockSize / cycles : 0.0,
+           cycles ? 100.0 * timing->busBusy / cycles : 0.0, timing->numMshrStalls, timing->mshrStallCycles);
+    if (prefetch) printf("Late prefetch hits: %lu (%lu cycles waited)\n", timing->numLatePrefetchHits, timing->lateCycles);
+    printf("Latency histogram:\n");
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        if (timing->histogram[i]) printf("  %lu-%lu cycles: %lu\n", i ? 1UL << (i - 1) : 0, i ? (1UL << i) - 1 : 0, timing->histogram[i]);
+}
+
+// Utility function to match a command line option. Returns the option's value ("" for a bare flag),
+// or NULL if arg is a different option.
+const char *optionValue(const char *arg, const char *name) {
+    size_t length = strlen(name);
+    if (strncmp(arg, "--", 2) || strncmp(arg + 2, name, length)) return NULL;
+    if (arg[2 + length] == '=') return arg + 3 + length;
+    return arg[2 + length] ? NULL : "";
+}
+
 int main(int argc, char const *argv[]) {
-    if (argc != 6) {
-        printf("Usage: %s <cache size> <associativity> <replacement policy> <block size> <trace file>\n", argv[0]);
+    levelConfig_t configs[MAX_LEVELS] = {{"L1D"}, {"L1I"}, {"L2"}, {"L3"}};
+
+    // Separate the options from the positional arguments.
+    const char *args[6] = {argv[0]}, *value;
+    int numArgs = 1, convert = 0, encoding = ENCODING_DELTA, compress = 0, inclusion = NON_INCLUSIVE, hierarchical = 0;
+    int writeBack = 0, writeAllocate = 1, writeBufferSize = 0;
+    const prefetcherType_t *prefetcherType = &prefetcherTypes[0];
+    int prefetchDegree = 1, prefetchDistance = 1, prefetchTableSize = 64, prefetchStats = 0, numThreads = 1;
+    int timing = 0, latencies[4] = {4, 12, 40, 200}, memoryBandwidth = 16, numMshrs = 8;
+    levelConfig_t tlbConfigs[3] = {{"L1 TLB"}, {"L2 TLB"}, {"Page walk cache"}};
+    int translated = 0, pageBits = 12;
+    const char *intervalPath = NULL, *checkpointPath = NULL, *restorePath = NULL;
+    ulong checkpointAt = 0, warmup = 0;
+    ulong intervalLength = 100000;
+    int profileTop = 0, profileRegion = 4096, profileEntries = 1 << 16;
+    int perf = 0, sampleRatio = 1, classify = 0, protocol = 0, reuse = 0, reuseSampleRatio = 1, reuseBlocks = 1 << 20, numTop = 10;
+    ulong windowSize = 100000;
+    ulong sampleSeed = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2)) {
+            if (numArgs < 6) args[numArgs] = argv[i];
+            numArgs++;
+        }
+        else if ((value = optionValue(argv[i], "convert"))) convert = 1;
+        else if ((value = optionValue(argv[i], "compress"))) compress = 1;
+        else if ((value = optionValue(argv[i], "encoding")) && (!strcmp(value, "fixed") || !strcmp(value, "delta")))
+            encoding = strcmp(value, "fixed") ? ENCODING_DELTA : ENCODING_FIXED;
+        else if (((value = optionValue(argv[i], "l1i")) && !parseLevel(&configs[LEVEL_L1I], value))
+                 || ((value = optionValue(argv[i], "l2")) && !parseLevel(&configs[LEVEL_L2], value))
+                 || ((value = optionValue(argv[i], "l3")) && !parseLevel(&configs[LEVEL_L3], value)))
+            hierarchical = 1;
+        else if ((value = optionValue(argv[i], "inclusion")) && (!strcmp(value, "inclusive") || !strcmp(value, "exclusive") || !strcmp(value, "non-inclusive")))
+            inclusion = !strcmp(value, "inclusive") ? INCLUSIVE : !strcmp(value, "exclusive") ? EXCLUSIVE : NON_INCLUSIVE;
+        else if ((value = optionValue(argv[i], "write-back"))) writeBack = 1;
+        else if ((value = optionValue(argv[i], "no-write-allocate"))) writeAllocate = 0;
+        else if ((value = optionValue(argv[i], "write-buffer")) && atoi(value) > 0) writeBufferSize = atoi(value);
+        else if ((value = optionValue(argv[i], "prefetcher")) && findPrefetcher(value)) {
+            prefetcherType = findPrefetcher(value);
+            prefetchStats = 1;
+        }
+        else if ((value = optionValue(argv[i], "prefetch-degree")) && atoi(value) > 0 && atoi(value) <= MAX_PREFETCH_DEGREE) {
+            prefetchDegree = atoi(value);
+            prefetchStats = 1;
+        }
+        else if ((value = optionValue(argv[i], "prefetch-distance")) && atoi(value) > 0) {
+            prefetchDistance = atoi(value);
+            prefetchStats = 1;
+        }
+        else if ((value = optionValue(argv[i], "prefetch-table")) && atoi(value) > 0) {
+            prefetchTableSize = atoi(value);
+            prefetchStats = 1;
+        }
+        else if ((value = optionValue(argv[i], "threads")) && atoi(value) > 0) numThreads = atoi(value);
+        else if ((value = optionValue(argv[i], "sample")) && atoi(value) > 0) sampleRatio = atoi(value);
+        else if ((value = optionValue(argv[i], "sample-seed")) && *value) sampleSeed = strtoul(value, NULL, 0);
+        else if ((value = optionValue(argv[i], "classify"))) classify = 1;
+        else if ((value = optionValue(argv[i], "perf"))) perf = 1;
+        else if ((value = optionValue(argv[i], "profile")) && (!*value || atoi(value) > 0)) profileTop = *value ? atoi(value) : 10;
+        else if ((value = optionValue(argv[i], "profile-region")) && atoi(value) > 0 && !(atoi(value) & (atoi(value) - 1))) profileRegion = atoi(value);
+        else if ((value = optionValue(argv[i], "profile-entries")) && atoi(value) > 0) profileEntries = atoi(value);
+        else if ((value = optionValue(argv[i], "timing")) && (!*value || parseLatencies(latencies, value))) timing = 1;
+        else if ((value = optionValue(argv[i], "mem-bandwidth")) && atoi(value) > 0) memoryBandwidth = atoi(value);
+        else if ((value = optionValue(argv[i], "mshrs")) && atoi(value) > 0) numMshrs = atoi(value);
+        else if (((value = optionValue(argv[i], "tlb")) && !parseTlb(&tlbConfigs[0], value))
+                 || ((value = optionValue(argv[i], "l2-tlb")) && !parseTlb(&tlbConfigs[1], value)))
+            translated = 1;
+        else if ((value = optionValue(argv[i], "walk-cache")) && atoi(value) > 0) {
+            // The page walk cache is fully associative.
+            tlbConfigs[2].cacheSize = tlbConfigs[2].associativity = atoi(value);
+            tlbConfigs[2].blockSize = 1;
+            tlbConfigs[2].policy = findPolicy("lru");
+        }
+        else if ((value = optionValue(argv[i], "checkpoint")) && *value) checkpointPath = value;
+        else if ((value = optionValue(argv[i], "checkpoint-at")) && atol(value) > 0) checkpointAt = atol(value);
+        else if ((value = optionValue(argv[i], "restore")) && *value) restorePath = value;
+        else if ((value = optionValue(argv[i], "warmup")) && atol(value) > 0) warmup = atol(value);
+        else if ((value = optionValue(argv[i], "intervals")) && *value) intervalPath = value;
+        else if ((value = optionValue(argv[i], "interval")) && atol(value) > 0) intervalLength = atol(value);
+        else if ((value = optionValue(argv[i], "page-size")) && (!strcmp(value, "4k") || !strcmp(value, "2m") || !strcmp(value, "1g")))
+            pageBits = !strcmp(value, "4k") ? 12 : !strcmp(value, "2m") ? 21 : 30;
+        else if ((value = optionValue(argv[i], "coherence")) && (!strcmp(value, "msi") || !strcmp(value, "mesi")))
+            protocol = strcmp(value, "msi") ? COHERENCE_MESI : COHERENCE_MSI;
+        else if ((value = optionValue(argv[i], "reuse"))) reuse = 1;
+        else if ((value = optionValue(argv[i], "reuse-sample")) && atoi(value) > 0 && atoi(value) <= REUSE_HASH_RANGE) reuseSampleRatio = atoi(value);
+        else if ((value = optionValue(argv[i], "reuse-blocks")) && atoi(value) >= REUSE_MIN_BLOCKS) reuseBlocks = atoi(value);
+        else if ((value = optionValue(argv[i], "window")) && atol(value) > 0) windowSize = atol(value);
+        else if ((value = optionValue(argv[i], "top")) && atoi(value) > 0) numTop = atoi(value);
+        else {
+            printf("Invalid option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (convert && numArgs == 3) return convertTrace(args[1], args[2], encoding, compress);
+
+    if (reuse && numArgs == 3 && atoi(args[1]) > 0 && !(atoi(args[1]) & (atoi(args[1]) - 1)))
+        return analyzeTrace(args[2], atoi(args[1]), reuseSampleRatio, reuseBlocks, windowSize, numTop);
+
+    if (numArgs != 6 || convert || reuse) {
+        printf("Usage: %s [options] <cache size> <associativity> <replacement policy> <block size> <trace file>\n", argv[0]);
+        printf("       replacement policy: lru, fifo, plru, srrip, brrip, drrip, random or lfu\n");
+        printf("       --l1i=<level>, --l2=<level>, --l3=<level>: add a cache level given as\n");
+        printf("           <cache size>,<associativity>,<replacement policy>,<block size>\n");
+        printf("       --inclusion=non-inclusive|inclusive|exclusive\n");
+        printf("       --write-back, --no-write-allocate: write policy of every level (default write-through, write-allocate)\n");
+        printf("       --write-buffer=<entries>: coalescing write buffer in front of memory\n");
+        printf("       --prefetcher=nextline|stride|stream, --prefetch-degree=<blocks>, --prefetch-distance=<blocks>,\n");
+        printf("           --prefetch-table=<entries>: prefetcher of the prefetching run (default nextline, degree 1, distance 1)\n");
+        printf("       --threads=<n>: split the sets of a single cache level across n threads; the run without\n");
+        printf("           prefetching is exact, the prefetching run is approximate (each thread trains its own\n");
+        printf("           prefetcher, and prefetches into other threads' sets arrive up to %d accesses late)\n", SHARD_EPOCH);
+        printf("       --sample=<n>, --sample-seed=<seed>: simulate a random 1 in n of the L1 data cache sets and\n");
+        printf("           extrapolate the results, with 95%% confidence intervals for the miss ratios (prefetches are only\n");
+        printf("           trained by, and useful to, the sampled sets)\n");
+        printf("       --classify: split the misses of every level into compulsory, capacity and conflict misses\n");
+        printf("       --timing[=<L1 latency>,<L2 latency>,<L3 latency>,<memory latency>]: time the accesses (default\n");
+        printf("           4,12,40,200 cycles), with --mem-bandwidth=<bytes per cycle> (default 16) and --mshrs=<n> (default 8)\n");
+        printf("       --tlb=<entries>,<associativity>, --l2-tlb=<entries>,<associativity>, --walk-cache=<entries>,\n");
+        printf("           --page-size=4k|2m|1g: translate addresses through TLBs, with page walks through the L1 data cache\n");
+        printf("       --intervals=<file>, --interval=<accesses>: write the statistics of every interval (default 100000\n");
+        printf("           accesses) with a phase id to a CSV file, or a JSON lines file if its name ends in .jsonl\n");
+        printf("       --checkpoint=<file>, --checkpoint-at=<accesses>: save the state of both runs after that many accesses\n");
+        printf("           of the trace (default at its end) and stop; --restore=<file>: resume from a checkpoint;\n");
+        printf("           --warmup=<accesses>: reset the counters after that many accesses (after the restored ones)\n");
+        printf("       --profile[=<k>]: print the k (default 10) PCs and address regions with the most misses, with\n");
+        printf("           their accesses, memory traffic and misses saved by prefetching; --profile-region=<bytes>:\n");
+        printf("           region size (default 4096); --profile-entries=<n>: keys tracked per profile (default 65536)\n");
+        printf("       --perf: print the simulation speed in accesses per second and the peak memory use\n");
+        printf("       --coherence=msi|mesi: simulate one core per trace (<trace file> is a comma separated list) with\n");
+        printf("           private write-back caches kept coherent by snooping, over shared --l2 and --l3 levels\n");
+        printf("       %s --convert [--encoding=delta|fixed] [--compress] <trace file> <binary trace file>\n", argv[0]);
+        printf("       %s --reuse [--reuse-sample=<n>] [--reuse-blocks=<blocks>] [--window=<accesses>] [--top=<k>] <block size> <trace file>\n", argv[0]);
+        printf("           reuse distance histogram, working set per window and hottest blocks, tracking at most\n");
+        printf("           <blocks> blocks, at least %d (the block sampling rate starts at 1 in n and halves when they run out)\n", REUSE_MIN_BLOCKS);
         return 1;
     }
 
-    // Initially assume fully associative cache for simplicity of parsing.
-    int cacheSize = atoi(argv[1]), blockSize = atoi(argv[4]), associativity = cacheSize / blockSize;
+    levelConfig_t *l1d = &configs[LEVEL_L1D];
+    l1d->cacheSize = atoi(args[1]);
+    l1d->blockSize = atoi(args[4]);
+    l1d->policy = findPolicy(args[3]);
 
-    if (cacheSize & !cacheSize & (cacheSize - 1) || blockSize & !blockSize & (blockSize - 1)) {
+    if (l1d->cacheSize <= 0 || l1d->cacheSize & (l1d->cacheSize - 1) || l1d->blockSize <= 0 || l1d->blockSize & (l1d->blockSize - 1)) {
         printf("Cache size and block size must be powers of 2\n");
         return 1;
     }
 
-    if (strcmp(argv[2], "direct") == 0) associativity = 1;
-    else if (strcmp(argv[2], "assoc")) {
-        char *dup = strdup(argv[2]);
-        associativity = atoi(strtok(dup, "assoc:"));
-        free(dup);
+    // A block size larger than the cache parses as one block, so that the check below reports it.
+    int numBlocks = l1d->cacheSize / l1d->blockSize;
+    l1d->associativity = parseAssociativity(args[2], numBlocks ? numBlocks : 1);
+    if (!l1d->associativity) {
+        printf("Associativity must be a power of 2\n");
+        return 1;
+    }
+
+    if (l1d->cacheSize < (long) l1d->blockSize * l1d->associativity) {
+        printf("Cache size must be at least the block size times the associativity\n");
+        return 1;
+    }
+
+    if (!l1d->policy) {
+        printf("Unknown replacement policy %s\n", args[3]);
+        return 1;
+    }
+
+    for (int i = 0; i < MAX_LEVELS; i++) {
+        configs[i].writeBack = writeBack;
+        configs[i].writeAllocate = writeAllocate;
+        if (configs[i].cacheSize && inclusion == EXCLUSIVE && configs[i].blockSize != l1d->blockSize) {
+            printf("Exclusive hierarchies need the same block size at every level\n");
+            return 1;
+        }
+    }
+
+    // Sharding relies on sets evolving independently, so it is limited to a single cache level without
+    // cross-set state other than prefetches (which are exchanged between shards at epoch boundaries). Each
+    // shard trains its prefetcher on its own accesses, so the prefetching run only approximates a single
+    // thread's, and drifts further the fewer sets each shard owns (prefetches then cross shards more often).
+    if (numThreads > 1 && (numThreads & (numThreads - 1) || numThreads > MAX_SHARDS
+                           || numThreads > l1d->cacheSize / (l1d->blockSize * l1d->associativity))) {
+        printf("The number of threads must be a power of 2 up to the number of sets (at most %d)\n", MAX_SHARDS);
+        return 1;
+    }
+    if (numThreads > 1 && (hierarchical || writeBufferSize || prefetcherType->train != nextLineTrain)) {
+        printf("--threads needs a single cache level, no write buffer and the next-line prefetcher\n");
+        return 1;
+    }
+
+    // Sampling filters accesses by their L1 data cache set, which would split the instruction stream and
+    // the shards' set ranges.
+    if (sampleRatio > 1 && (sampleRatio > l1d->cacheSize / (l1d->blockSize * l1d->associativity) || numThreads > 1 || configs[LEVEL_L1I].cacheSize)) {
+        printf("--sample needs at most as many sets as the L1 data cache has, and no --threads or --l1i\n");
+        return 1;
+    }
+
+    // Translation needs an L1 TLB, and page walks reach sets that sampling or sharding would filter out.
+    if ((translated || tlbConfigs[2].cacheSize) && (!tlbConfigs[0].cacheSize || numThreads > 1 || sampleRatio > 1 || protocol)) {
+        printf("Address translation needs --tlb and cannot be combined with --threads, --sample or --coherence\n");
+        return 1;
+    }
+
+    // Checkpoints hold the caches, replacement metadata, counters and prefetcher of both runs.
+    if ((checkpointPath || restorePath || warmup) && (numThreads > 1 || sampleRatio > 1 || classify || timing || protocol || intervalPath || profileTop)) {
+        printf("--checkpoint, --restore and --warmup cannot be combined with --threads, --sample, --classify, --timing,\n");
+        printf("--coherence, --intervals or --profile\n");
+        return 1;
+    }
+
+    // Intervals follow the order of all accesses through one hierarchy.
+    if (intervalPath && (numThreads > 1 || sampleRatio > 1 || protocol)) {
+        printf("--intervals cannot be combined with --threads, --sample or --coherence\n");
+        return 1;
+    }
+
+    // Timing follows the order of all accesses through one hierarchy.
+    if (timing && (numThreads > 1 || sampleRatio > 1)) {
+        printf("--timing cannot be combined with --threads or --sample\n");
+        return 1;
+    }
+
+    // The shadow cache of the classification is fully associative, so it cannot be split by set.
+    if (classify && (numThreads > 1 || sampleRatio > 1)) {
+        printf("--classify cannot be combined with --threads or --sample\n");
+        return 1;
+    }
+
+    // Profiles count every access of the trace with the outcome of both runs.
+    if (profileTop && (numThreads > 1 || sampleRatio > 1 || protocol)) {
+        printf("--profile cannot be combined with --threads, --sample or --coherence\n");
+        return 1;
+    }
 
-        if (associativity & !associativity & (associativity - 1)) {
-            printf("Associativity must be a power of 2\n");
+    // Coherence replaces the two runs with a single multi-core run over non-inclusive shared levels.
+    if (protocol) {
+        if (numThreads > 1 || sampleRatio > 1 || classify || timing || perf || prefetchStats || inclusion != NON_INCLUSIVE || configs[LEVEL_L1I].cacheSize || !writeAllocate) {
+            printf("--coherence needs a non-inclusive hierarchy without --l1i, --threads, --sample, --classify, --timing, --perf,\n");
+            printf("prefetching or --no-write-allocate\n");
             return 1;
         }
+        return runCoherent(args[5], configs, protocol, writeBufferSize);
     }
 
-    int isFifo = strcmp(argv[3], "fifo") == 0, numSets = cacheSize / (blockSize * associativity);
+    intervalStats_t intervals;
+    memset(&intervals, 0, sizeof(intervals));
+    intervals.length = intervalLength;
+    if (intervalPath) {
+        size_t length = strlen(intervalPath);
+        intervals.json = length > 6 && !strcmp(intervalPath + length - 6, ".jsonl");
+        if (!(intervals.file = fopen(intervalPath, "w"))) {
+            printf("Could not open interval file\n");
+            return 1;
+        }
+        if (!intervals.json) fprintf(intervals.file, "interval,accesses,prefetch,hit_rate,hits,misses,memory_reads,memory_writes,prefetches,useful_prefetches,phase\n");
+    }
 
-    FILE *traceFile = fopen(argv[5], "r");
-    if (!traceFile) {
+    traceReader_t trace;
+    if (openTrace(&trace, args[5])) {
         printf("Could not open trace file\n");
+        if (intervals.file) fclose(intervals.file);
         return 1;
     }
 
-    int s = _log2(numSets), b = _log2(blockSize);
-    cache_t *prefetchingCache = (cache_t *) malloc(sizeof(cache_t));
-    cache_t *nonPrefetchingCache = (cache_t *) malloc(sizeof(cache_t));
+    // Initialize the hierarchies of the non-prefetching and the prefetching runs.
+    hierarchy_t runs[2];
+    initHierarchy(&runs[0], configs, inclusion, writeBufferSize);
+    initHierarchy(&runs[1], configs, inclusion, writeBufferSize);
+    // The instruction caches of both runs see the same accesses, so they share their classifiers. The data
+    // caches and the levels below also see the prefetches of the second run.
+    for (int i = 0; classify && i < MAX_LEVELS; i++)
+        if (runs[0].levels[i]) {
+            int shared = i == LEVEL_L1I;
+            initClassifier(runs[0].levels[i], shared ? runs[1].levels[i] : NULL);
+            if (!shared) initClassifier(runs[1].levels[i], NULL);
+        }
+    translation_t translations[2];
+    for (int run = 0; translated && run < 2; run++) {
+        translation_t *translation = &translations[run];
+        memset(translation, 0, sizeof(translation_t));
+        translation->pageBits = pageBits;
+        for (int i = 0; i < 2 && tlbConfigs[i].cacheSize; i++) {
+            initCache(&translation->tlbs[i], &tlbConfigs[i]);
+            if (i) translation->tlbs[0].next = &translation->tlbs[1];
+            translation->numTlbs++;
+        }
+        if ((translation->hasWalkCache = tlbConfigs[2].cacheSize > 0)) initCache(&translation->walkCache, &tlbConfigs[2]);
+    }
+    for (int run = 0; timing && run < 2; run++) {
+        for (int i = 0; i < MAX_LEVELS; i++)
+            if (runs[run].levels[i]) runs[run].levels[i]->latency = latencies[i <= LEVEL_L1I ? 0 : i - 1];
+        initTiming(runs[run].levels[LEVEL_L1D], latencies[3], memoryBandwidth, numMshrs);
+    }
+
+    prefetcher_t prefetcher;
+    initPrefetcher(&prefetcher, prefetcherType, prefetchDegree, prefetchDistance, prefetchTableSize, runs[1].levels[LEVEL_L1D]);
 
-    // Initialize caches
-    initCache(prefetchingCache, numSets, associativity);
-    initCache(nonPrefetchingCache, numSets, associativity);
+    // Profiles attribute the memory traffic of the data side of the run without prefetching to the accesses.
+    profile_t profiles[2];
+    cache_t *memorySide = runs[0].levels[LEVEL_L1D];
+    while (memorySide->next) memorySide = memorySide->next;
+    if (profileTop) {
+        initProfile(&profiles[0], profileEntries, 0);
+        initProfile(&profiles[1], profileEntries, _log2(profileRegion));
+    }
+
+    setSampler_t sampler, *sampling = NULL;
+    if (sampleRatio > 1) {
+        sampling = &sampler;
+        initSampler(&sampler, runs[0].levels[LEVEL_L1D], sampleRatio, sampleSeed);
+    }
+
+    access_t access;
+    ulong numAccesses = 0;
+    int checkpointError = 0, checkpointSaved = 0;
+    int restoreError = restorePath && loadCheckpoint(restorePath, &trace, &numAccesses, runs, &prefetcher, translated ? translations : NULL);
+    ulong warmupEnd = warmup ? numAccesses + warmup : 0, firstAccess = numAccesses;
 
-    char accessType;
-    ulong address;
+    // The speed covers decoding and simulating the trace, not setting up the caches.
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
     // char debugFileName[100];
-    // sprintf(debugFileName, "%s.%s.%d.%s.%d-debug.csv", argv[5], argv[3], cacheSize, argv[2], blockSize);
+    // sprintf(debugFileName, "%s.%s.%d.%s.%d-debug.csv", args[5], args[3], cacheSize, args[2], blockSize);
     // FILE *debugFile = fopen(debugFileName, "w+");
 
-    while (fscanf(traceFile, "%*x: %c %lx", &accessType, &address) == 2) {
-        ulong setIndex = (address >> b) & ((1 << s) - 1);
-        ulong tag = address >> (b + s);
-        ulong prefetchAddress = address + blockSize;
-        ulong prefetchSetIndex = (prefetchAddress >> b) & ((1 << s) - 1);
-        ulong prefetchTag = prefetchAddress >> (b + s);
-
+    if (restoreError) printf("Could not restore checkpoint\n");
+    else if (numThreads > 1) numAccesses = runSharded(&trace, runs, l1d, &prefetcher, numThreads);
+    else while (readAccess(&trace, &access)) {
         // Debugging
-        // fprintf(debugFile, "%c, %lx, %lx, %ld, ", accessType, address, tag, setIndex);
+        // fprintf(debugFile, "%c, %lx, ", accessType, address);
+
+        // Set sampling: accesses to sets that are not sampled are dropped right after decoding.
+        ulong setIndex = 0;
+        if (sampling) {
+            sampler.numAccesses++;
+            setIndex = setIndexOf(runs[0].levels[LEVEL_L1D], access.address);
+            if (!sampler.sampled[setIndex]) continue;
+            sampler.numSampledAccesses++;
+            sampler.accesses[setIndex]++;
+        }
+
+        int missed[2];
+        ulong memReads = 0, memWrites = 0;
+        for (int prefetch = 0; prefetch < 2; prefetch++) {
+            // Instruction fetches only go through the hierarchy if there is an L1 instruction cache.
+            if (runs[prefetch].levels[LEVEL_L1I]) accessLevel(runs[prefetch].levels[LEVEL_L1I], access.pc, 0);
+            if (profileTop && !prefetch) {
+                memReads = memorySide->numMemReads;
+                memWrites = memoryWrites(memorySide);
+            }
+            if (translated) translate(&translations[prefetch], runs[prefetch].levels[LEVEL_L1D], access.address);
+            int result = processTransaction(runs[prefetch].levels[LEVEL_L1D], prefetch ? &prefetcher : NULL, access.pc, access.address, access.isWrite, NULL);
+            if (sampling) sampler.misses[prefetch][setIndex] += result == ACCESS_MISS;
+            missed[prefetch] = result == ACCESS_MISS;
+            if (profileTop && !prefetch) {
+                memReads = memorySide->numMemReads - memReads;
+                memWrites = memoryWrites(memorySide) - memWrites;
+            }
+        }
+        if (profileTop) {
+            countProfile(&profiles[0], access.pc, missed[0], missed[1], memReads, memWrites);
+            countProfile(&profiles[1], access.address, missed[0], missed[1], memReads, memWrites);
+        }
+
+        numAccesses++;
+        if (numAccesses == warmupEnd)
+            for (int run = 0; run < 2; run++) {
+                forEachCache(&runs[run], translated ? &translations[run] : NULL, resetCounters, NULL);
+                if (translated) translations[run].numWalks = translations[run].numWalkReferences = translations[run].numWalkMisses = translations[run].numWalkCacheHits = 0;
+            }
+        if (numAccesses == checkpointAt && checkpointPath) {
+            checkpointError = saveCheckpoint(checkpointPath, &trace, numAccesses, runs, &prefetcher, translated ? translations : NULL);
+            checkpointSaved = 1;
+            break;
+        }
 
-        processTransaction(nonPrefetchingCache, associativity, numSets, setIndex, tag, prefetchSetIndex, prefetchTag, accessType == 'W', isFifo, 0, NULL);
-        processTransaction(prefetchingCache, associativity, numSets, setIndex, tag, prefetchSetIndex, prefetchTag, accessType == 'W', isFifo, 1, NULL);
+        if (intervals.file) {
+            intervals.vector[mixHash(access.pc) % PHASE_DIMENSIONS]++;
+            if (++intervals.count == intervals.length) emitInterval(&intervals, runs, numAccesses);
+        }
     }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (intervals.file && intervals.count) emitInterval(&intervals, runs, numAccesses);
+    if (checkpointPath && !checkpointSaved && !restoreError && !trace.error)
+        checkpointError = saveCheckpoint(checkpointPath, &trace, numAccesses, runs, &prefetcher, translated ? translations : NULL);
+    if (checkpointPath && checkpointError) printf("Could not write checkpoint\n");
 
-    fclose(traceFile);
+    int traceError = trace.error;
+    closeTrace(&trace);
     // fclose(debugFile);
 
     // Print the results.
-    printf("Prefetch 0\n");
-    printf("Memory reads: %d\n", nonPrefetchingCache->numMemReads);
-    printf("Memory writes: %d\n", nonPrefetchingCache->numMemWrites);
-    printf("Cache hits: %d\n", nonPrefetchingCache->numHits);
-    printf("Cache misses: %d\n", nonPrefetchingCache->numMisses);
-    printf("Prefetch 1\n");
-    printf("Memory reads: %d\n", prefetchingCache->numMemReads);
-    printf("Memory writes: %d\n", prefetchingCache->numMemWrites);
-    printf("Cache hits: %d\n", prefetchingCache->numHits);
-    printf("Cache misses: %d\n", prefetchingCache->numMisses);
+    if (traceError) printf("Corrupt trace file\n");
+    else if (!restoreError) {
+        for (int prefetch = 0; prefetch < 2; prefetch++) {
+            hierarchy_t *hierarchy = &runs[prefetch];
+            ulong memReads, memWrites, coalesced;
+            memoryTraffic(hierarchy, &memReads, &memWrites, &coalesced);
 
-    // Free memory.
-    for (int i = 0; i < numSets; i++) {
-        for (int j = 0; j < associativity; j++) {
-            free(prefetchingCache->cache[i][j]);
-            free(nonPrefetchingCache->cache[i][j]);
+            // Counters of a sampled run are scaled up to the whole trace.
+            printf("Prefetch %d\n", prefetch);
+            printf("Memory reads: %lu\n", extrapolate(sampling, memReads));
+            printf("Memory writes: %lu\n", extrapolate(sampling, memWrites));
+            printf("Cache hits: %lu\n", extrapolate(sampling, hierarchy->levels[LEVEL_L1D]->numHits));
+            printf("Cache misses: %lu\n", extrapolate(sampling, hierarchy->levels[LEVEL_L1D]->numMisses));
+            if (writeBufferSize) printf("Coalesced writes: %lu\n", extrapolate(sampling, coalesced));
+            if (classify) {
+                cache_t *l1d = hierarchy->levels[LEVEL_L1D];
+                printf("Compulsory misses: %lu, capacity misses: %lu, conflict misses: %lu\n",
+                       l1d->numCompulsoryMisses, l1d->numCapacityMisses, l1d->numConflictMisses);
+            }
+            if (sampling) {
+                double missRatio, interval = missRatioInterval(&sampler, prefetch, &missRatio);
+                printf("Sampled sets: %d of %d (%lu of %lu accesses)\n", sampler.numSampled, sampler.numSets, sampler.numSampledAccesses, sampler.numAccesses);
+                printf("Miss ratio: %.4f%% +- %.4f%% (95%% confidence)\n", 100.0 * missRatio, 100.0 * interval);
+            }
+            if (prefetch && prefetchStats) {
+                cache_t *l1d = hierarchy->levels[LEVEL_L1D];
+                printf("Prefetches: %lu, useful: %lu, unused evicted: %lu, polluting misses: %lu\n",
+                       l1d->numPrefetches, l1d->numUsefulPrefetches, l1d->numUnusedPrefetches, l1d->numPollutionMisses);
+                printf("Prefetch accuracy: %.2f%%, coverage: %.2f%%\n",
+                       l1d->numPrefetches ? 100.0 * l1d->numUsefulPrefetches / l1d->numPrefetches : 0.0,
+                       l1d->numUsefulPrefetches ? 100.0 * l1d->numUsefulPrefetches / (l1d->numUsefulPrefetches + l1d->numMisses) : 0.0);
+            }
+            if (translated) printTranslation(&translations[prefetch]);
+            if (timing) printTiming(hierarchy->levels[LEVEL_L1D]->timing, 1 << hierarchy->levels[LEVEL_L1D]->blockBits, prefetch);
+            if (hierarchical) printHierarchy(hierarchy, sampling);
+        }
+
+        // Each phase is represented by its first interval, weighted by the share of intervals in the phase.
+        if (intervals.file) {
+            printf("Intervals: %lu, phases: %d\n", intervals.index, intervals.numPhases);
+            for (int i = 0; i < intervals.numPhases; i++)
+                printf("Phase %d: %lu intervals (%.2f%%), representative interval %lu\n", i, intervals.phaseIntervals[i],
+                       100.0 * intervals.phaseIntervals[i] / intervals.index, intervals.phaseRepresentatives[i]);
+        }
+
+        if (profileTop) {
+            printProfile(&profiles[0], "PC", profileTop);
+            printProfile(&profiles[1], "region", profileTop);
+        }
+
+        // Sampled runs are measured over every access of the trace, including the dropped ones. The peak
+        // resident set size is in kilobytes on Linux (bytes on macOS).
+        if (perf) {
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            ulong simulated = sampling ? sampler.numAccesses : numAccesses - firstAccess;
+            printf("Simulated accesses: %lu, time: %.3f s, speed: %.0f accesses/s\n", simulated, seconds, seconds > 0 ? simulated / seconds : 0.0);
+            printf("Peak memory: %ld KB\n", usage.ru_maxrss);
         }
-        free(prefetchingCache->cache[i]);
-        free(nonPrefetchingCache->cache[i]);
     }
-    free(prefetchingCache->cache);
-    free(nonPrefetchingCache->cache);
-    free(prefetchingCache);
-    free(nonPrefetchingCache);
+    if (intervals.file) fclose(intervals.file);
+    if (profileTop) {
+        freeProfile(&profiles[0]);
+        freeProfile(&profiles[1]);
+    }
 
-    return 0;
+    // Free memory.
+    freeHierarchy(&runs[0]);
+    freeHierarchy(&runs[1]);
+    free(prefetcher.table);
+    if (sampling) freeSampler(&sampler);
+    for (int run = 0; translated && run < 2; run++) {
+        for (int i = 0; i < translations[run].numTlbs; i++) freeCache(&translations[run].tlbs[i]);
+        if (translations[run].hasWalkCache) freeCache(&translations[run].walkCache);
+    }
+
+    return traceError || restoreError || checkpointError;
 }
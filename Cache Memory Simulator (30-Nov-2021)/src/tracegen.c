@@ -0,0 +1,253 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned long int ulong;
+
+// Access patterns of the generator.
+enum { PATTERN_SEQUENTIAL, PATTERN_STRIDE, PATTERN_RANDOM, PATTERN_ZIPF, PATTERN_CHASE, PATTERN_MATRIX, NUM_PATTERNS };
+
+// Names of the access patterns on the command line.
+const char *patternNames[NUM_PATTERNS] = {"seq", "stride", "random", "zipf", "chase", "matrix"};
+
+// Each pattern of a mix gets its own PC range and its own region of the address space.
+#define PC_BASE 0x400000UL
+#define REGION_BASE 0x10000000UL
+#define REGION_SIZE (1UL << 36)
+#define MAX_MIX 16
+
+// Struct type to store the parameters of the generator.
+typedef struct {
+    ulong footprint, stride, seed;
+    double writeRatio, zipfAlpha;
+    int matrixSize, tileSize, burst;
+} generatorConfig_t;
+
+// Struct type to store the state of one access pattern.
+typedef struct {
+    int pattern;
+    ulong base, pc, numElements, position, rng;
+    // Zipfian patterns: the cumulative distribution of the ranks. Pointer chasing: the next node of each node.
+    double *cdf;
+    ulong *next;
+    // Matrix tiling: the loop indices of a tiled matrix multiplication C += A * B.
+    int ii, jj, kk, i, j, k;
+} stream_t;
+
+// Struct type to store a generated memory access.
+typedef struct {
+    ulong pc, address;
+    int isWrite;
+} access_t;
+
+// Utility function to generate a pseudo-random number (xorshift64), so traces are reproducible.
+ulong nextRandom(ulong *rng) {
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 7;
+    *rng ^= *rng << 17;
+    return *rng;
+}
+
+// Utility function to generate a pseudo-random number in [0, 1).
+double randomUnit(ulong *rng) {
+    return (nextRandom(rng) >> 11) * (1.0 / (1UL << 53));
+}
+
+// Function to find an access pattern by name. Returns -1 if there is no such pattern.
+int findPattern(const char *name) {
+    for (int i = 0; i < NUM_PATTERNS; i++)
+        if (strcmp(patternNames[i], name) == 0) return i;
+    return -1;
+}
+
+// Function to initialize the state of an access pattern, the index-th pattern of a mix.
+void initStream(stream_t *stream, int pattern, int index, const generatorConfig_t *config) {
+    memset(stream, 0, sizeof(stream_t));
+    stream->pattern = pattern;
+    stream->base = REGION_BASE + index * REGION_SIZE;
+    stream->pc = PC_BASE + index * 0x1000UL;
+    stream->rng = config->seed * 0x9e3779b97f4a7c15UL + index + 1;
+    ulong elementSize = pattern == PATTERN_STRIDE || pattern == PATTERN_CHASE ? config->stride : 8;
+    stream->numElements = config->footprint / elementSize ? config->footprint / elementSize : 1;
+
+    // Zipfian ranks: rank r (from 0) is drawn with a probability proportional to 1 / (r + 1)^alpha.
+    if (pattern == PATTERN_ZIPF) {
+        stream->cdf = (double *) malloc(stream->numElements * sizeof(double));
+        double sum = 0;
+        for (ulong r = 0; r < stream->numElements; r++) stream->cdf[r] = sum += pow(r + 1, -config->zipfAlpha);
+        for (ulong r = 0; r < stream->numElements; r++) stream->cdf[r] /= sum;
+    }
+
+    // Pointer chasing follows a single random cycle through every node (Sattolo's shuffle).
+    if (pattern == PATTERN_CHASE) {
+        ulong *order = (ulong *) malloc(stream->numElements * sizeof(ulong));
+        stream->next = (ulong *) malloc(stream->numElements * sizeof(ulong));
+        for (ulong i = 0; i < stream->numElements; i++) order[i] = i;
+        for (ulong i = stream->numElements - 1; i > 0; i--) {
+            ulong j = nextRandom(&stream->rng) % i, swap = order[i];
+            order[i] = order[j];
+            order[j] = swap;
+        }
+        for (ulong i = 0; i < stream->numElements; i++) stream->next[order[i]] = order[(i + 1) % stream->numElements];
+        free(order);
+    }
+}
+
+// Function to free the buffers of an access pattern.
+void freeStream(stream_t *stream) {
+    free(stream->cdf);
+    free(stream->next);
+}
+
+// Function to generate the next access of a tiled matrix multiplication over three n x n matrices of 8-byte
+// elements: for every tile, C[i][j] is read, updated with A[i][k] * B[k][j] for every k of the tile, and written.
+void matrixAccess(stream_t *stream, const generatorConfig_t *config, access_t *access) {
+    ulong n = config->matrixSize, tile = config->tileSize, size = n * n * 8;
+    ulong i = stream->ii + stream->i, j = stream->jj + stream->j, k = stream->kk + stream->k;
+    // Steps: 0 reads C[i][j], 1 reads A[i][k], 2 reads B[k][j], 3 writes C[i][j].
+    int step = stream->position;
+
+    access->isWrite = step == 3;
+    access->pc = stream->pc + step * 4;
+    if (step == 0 || step == 3) access->address = stream->base + 2 * size + (i * n + j) * 8;
+    else if (step == 1) access->address = stream->base + (i * n + k) * 8;
+    else access->address = stream->base + size + (k * n + j) * 8;
+
+    // After B[k][j], continue with the next k of the tile, or write C[i][j] back after the last one.
+    if (step < 2) stream->position = step + 1;
+    else if (step == 2) stream->position = ++stream->k < (int) tile && k + 1 < n ? 1 : 3;
+    if (step != 3) return;
+    stream->position = 0;
+    stream->k = 0;
+    if (++stream->j == (int) tile || stream->jj + stream->j == (int) n) {
+        stream->j = 0;
+        if (++stream->i == (int) tile || stream->ii + stream->i == (int) n) {
+            stream->i = 0;
+            if ((stream->kk += tile) >= (int) n) {
+                stream->kk = 0;
+                if ((stream->jj += tile) >= (int) n) {
+                    stream->jj = 0;
+                    if ((stream->ii += tile) >= (int) n) stream->ii = 0;
+                }
+            }
+        }
+    }
+}
+
+// Function to generate the next access of an access pattern. Accesses other than the matrix updates are
+// writes with probability writeRatio.
+void nextAccess(stream_t *stream, const generatorConfig_t *config, access_t *access) {
+    access->pc = stream->pc;
+    access->isWrite = randomUnit(&stream->rng) < config->writeRatio;
+
+    switch (stream->pattern) {
+        case PATTERN_SEQUENTIAL:
+            access->address = stream->base + (stream->position++ % stream->numElements) * 8;
+            break;
+        case PATTERN_STRIDE:
+            access->address = stream->base + (stream->position++ % stream->numElements) * config->stride;
+            break;
+        case PATTERN_RANDOM:
+            access->address = stream->base + nextRandom(&stream->rng) % stream->numElements * 8;
+            break;
+        case PATTERN_ZIPF: {
+            // Find the rank by binary search over the distribution, then scatter the ranks over the footprint.
+            double u = randomUnit(&stream->rng);
+            ulong low = 0, high = stream->numElements - 1;
+            while (low < high) {
+                ulong middle = (low + high) / 2;
+                if (stream->cdf[middle] < u) low = middle + 1;
+                else high = middle;
+            }
+            access->address = stream->base + (low * 0x9e3779b1UL % stream->numElements) * 8;
+            access->pc = stream->pc + (low & 7) * 4;
+            break;
+        }
+        case PATTERN_CHASE:
+            access->address = stream->base + stream->position * config->stride;
+            stream->position = stream->next[stream->position];
+            break;
+        default:
+            matrixAccess(stream, config, access);
+            break;
+    }
+}
+
+// Utility function to match a command line option. Returns the option's value, or NULL if arg is a
+// different option.
+const char *optionValue(const char *arg, const char *name) {
+    size_t length = strlen(name);
+    if (strncmp(arg, "--", 2) || strncmp(arg + 2, name, length) || arg[2 + length] != '=') return NULL;
+    return arg + 3 + length;
+}
+
+int main(int argc, char const *argv[]) {
+    generatorConfig_t config = {64UL << 20, 256, 1, 0.3, 0.99, 256, 32, 1000};
+
+    // Separate the options from the positional arguments.
+    const char *args[4] = {argv[0]}, *value;
+    int numArgs = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2)) {
+            if (numArgs < 4) args[numArgs] = argv[i];
+            numArgs++;
+        }
+        else if ((value = optionValue(argv[i], "footprint")) && atol(value) >= 8) config.footprint = atol(value);
+        else if ((value = optionValue(argv[i], "stride")) && atol(value) > 0) config.stride = atol(value);
+        else if ((value = optionValue(argv[i], "seed"))) config.seed = strtoul(value, NULL, 0);
+        else if ((value = optionValue(argv[i], "write-ratio")) && atof(value) >= 0 && atof(value) <= 1) config.writeRatio = atof(value);
+        else if ((value = optionValue(argv[i], "zipf-alpha")) && atof(value) > 0) config.zipfAlpha = atof(value);
+        else if ((value = optionValue(argv[i], "matrix-size")) && atoi(value) > 0) config.matrixSize = atoi(value);
+        else if ((value = optionValue(argv[i], "tile")) && atoi(value) > 0) config.tileSize = atoi(value);
+        else if ((value = optionValue(argv[i], "burst")) && atoi(value) > 0) config.burst = atoi(value);
+        else {
+            printf("Invalid option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (numArgs != 4 || atol(args[2]) <= 0) {
+        printf("Usage: %s [options] <pattern>[,<pattern>...] <accesses> <trace file>\n", argv[0]);
+        printf("       pattern: seq, stride, random, zipf, chase or matrix; a list of patterns takes turns in bursts\n");
+        printf("       --footprint=<bytes>: bytes touched by each pattern (default 64 MiB)\n");
+        printf("       --stride=<bytes>: stride of stride accesses and node size of pointer chasing (default 256)\n");
+        printf("       --write-ratio=<fraction>: share of writes (default 0.3; matrix writes follow the loop)\n");
+        printf("       --zipf-alpha=<alpha>: skew of zipf accesses (default 0.99)\n");
+        printf("       --matrix-size=<n>, --tile=<n>: tiled n x n matrix multiplication (default 256, tiles of 32)\n");
+        printf("       --burst=<accesses>: accesses of a pattern before the next one of a list takes over (default 1000)\n");
+        printf("       --seed=<seed>: random seed (default 1)\n");
+        return 1;
+    }
+
+    stream_t streams[MAX_MIX];
+    int numStreams = 0, status = 0;
+    char *dup = strdup(args[1]), *rest = dup, *name;
+    while (!status && (name = strsep(&rest, ","))) {
+        int pattern = findPattern(name);
+        if (pattern < 0 || numStreams == MAX_MIX) {
+            printf(pattern < 0 ? "Unknown pattern %s\n" : "At most 16 patterns can be mixed (%s)\n", name);
+            status = 1;
+        }
+        else initStream(&streams[numStreams], pattern, numStreams, &config), numStreams++;
+    }
+    free(dup);
+
+    FILE *file = status ? NULL : fopen(args[3], "w");
+    if (!status && !file) {
+        printf("Could not open trace file\n");
+        status = 1;
+    }
+
+    // Write the trace in the text format read by cachesim.
+    ulong numAccesses = status ? 0 : atol(args[2]);
+    access_t access;
+    for (ulong i = 0; i < numAccesses; i++) {
+        nextAccess(&streams[i / config.burst % numStreams], &config, &access);
+        fprintf(file, "%#lx: %c %#lx\n", access.pc, access.isWrite ? 'W' : 'R', access.address);
+    }
+    if (file) fclose(file);
+
+    for (int i = 0; i < numStreams; i++) freeStream(&streams[i]);
+    return status;
+}
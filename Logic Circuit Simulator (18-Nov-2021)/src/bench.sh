@@ -0,0 +1,64 @@
+#!/bin/sh
+# Benchmark of truthtable: generates netlists of several circuits and sizes, and reports the parse time, the
+# graph build time and the rows evaluated per second of each, checking the truth table against a reference run.
+# Usage: bench.sh <bench directory> <reference file> [--save]
+# The bench directory holds optimized builds of truthtable and netgen. --save stores the checksums of the
+# truth tables as the new reference.
+
+dir=$1
+reference=$2
+save=$3
+
+# Sizes stay within the 256 wires truthtable can map, and the rows within a few seconds per circuit.
+circuits="ripple 4
+ripple 8
+lookahead 4
+lookahead 8
+multiplier 4
+multiplier 6
+mux 2
+mux 3
+decoder 4
+decoder 6
+parity 8
+parity 16
+random 12 100 8 3
+random 14 200 16 2"
+
+results=$dir/results.txt
+: > "$results"
+failed=0
+printf "%-20s %6s %6s %10s %10s %8s %10s %6s\n" circuit gates wires parse-s build-s rows rows/s check
+
+echo "$circuits" | {
+    while read -r circuit; do
+        name=$(echo "$circuit" | tr ' ' -)
+        # shellcheck disable=SC2086
+        "$dir/netgen" $circuit > "$dir/$name.txt" || exit 1
+        "$dir/truthtable" --timing "$dir/$name.txt" > "$dir/$name.out" 2> "$dir/$name.time" || exit 1
+
+        checksum=$(cksum < "$dir/$name.out" | cut -d ' ' -f 1)
+        echo "$name $checksum" >> "$results"
+        expected=$([ -f "$reference" ] && grep "^$name " "$reference" | cut -d ' ' -f 2)
+        if [ -z "$expected" ]; then check=-
+        elif [ "$expected" = "$checksum" ]; then check=ok
+        else
+            check=DIFF
+            failed=1
+        fi
+
+        awk -v name="$name" -v check="$check" '
+            /^Parse:/ { parse = $2; gates = substr($4, 2); wires = $6 }
+            /^Graph build:/ { build = $3 }
+            /^Evaluation:/ { rows = $2; speed = substr($7, 2) }
+            END { printf "%-20s %6s %6s %10s %10s %8s %10s %6s\n", name, gates, wires, parse, build, rows, speed, check }
+        ' "$dir/$name.time"
+    done
+    [ $failed = 0 ] || echo "Truth tables differ from the reference run"
+    exit $failed
+} || exit 1
+
+if [ "$save" = --save ]; then
+    cp "$results" "$reference"
+    echo "Saved reference to $reference"
+fi
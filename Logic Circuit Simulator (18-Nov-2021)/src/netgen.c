@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Struct type to store a wire label. Labels are at most 16 characters, like the tokens read by truthtable.
+typedef struct {
+    char key[17];
+} label_t;
+
+// Struct type to store the state of the netlist writer: the output file and the number of temporaries.
+typedef struct {
+    FILE *fp;
+    int nTemps;
+} netlist_t;
+
+// Function to make a label from a prefix and an index (a0, b7, s12, ...).
+label_t label(const char *prefix, int index) {
+    label_t wire;
+    snprintf(wire.key, sizeof(wire.key), "%s%d", prefix, index);
+    return wire;
+}
+
+// Function to make the label of a constant wire (0 or 1).
+label_t constant(int value) {
+    label_t wire;
+    strcpy(wire.key, value ? "1" : "0");
+    return wire;
+}
+
+// Function to write the INPUT or OUTPUT line of n wires named prefix(n-1) ... prefix0, most significant first.
+void write_wires(netlist_t *net, const char *directive, int n, const char **prefixes, const int *counts, int nPrefixes) {
+    fprintf(net->fp, "%s %d", directive, n);
+    for (int p = 0; p < nPrefixes; p++)
+        for (int i = counts[p] - 1; i >= 0; i--) fprintf(net->fp, " %s", label(prefixes[p], i).key);
+    fprintf(net->fp, "\n");
+}
+
+// Function to write a gate with one or two inputs to the given output wire.
+void gate_to(netlist_t *net, const char *type, label_t a, label_t *b, label_t out) {
+    if (b) fprintf(net->fp, "%s %s %s %s\n", type, a.key, b->key, out.key);
+    else fprintf(net->fp, "%s %s %s\n", type, a.key, out.key);
+}
+
+// Function to write a two input gate to a new temporary wire. Returns the temporary.
+label_t gate2(netlist_t *net, const char *type, label_t a, label_t b) {
+    label_t out = label("t", net->nTemps++);
+    gate_to(net, type, a, &b, out);
+    return out;
+}
+
+// Function to add two n-bit numbers with a chain of full adders (a half adder for the least significant bit).
+// The n + 1 bits of the sum, least significant first, are stored in sum.
+void ripple_add(netlist_t *net, const label_t *a, const label_t *b, int n, label_t *sum) {
+    label_t carry = constant(0);
+    for (int i = 0; i < n; i++) {
+        label_t p = gate2(net, "XOR", a[i], b[i]);
+        label_t g = gate2(net, "AND", a[i], b[i]);
+        if (i == 0) {
+            sum[i] = p;
+            carry = g;
+            continue;
+        }
+        sum[i] = gate2(net, "XOR", p, carry);
+        carry = gate2(net, "OR", g, gate2(net, "AND", p, carry));
+    }
+    sum[n] = carry;
+}
+
+// Function to copy the internal wires of a result to the output wires prefix0 ... prefix(n-1).
+void write_outputs(netlist_t *net, const label_t *wires, int n, const char *prefix) {
+    for (int i = 0; i < n; i++) gate_to(net, "PASS", wires[i], NULL, label(prefix, i));
+}
+
+// Function to generate an n-bit ripple carry adder: s = a + b.
+void ripple_adder(netlist_t *net, int n) {
+    const char *inputs[] = {"a", "b"}, *outputs[] = {"s"};
+    write_wires(net, "INPUT", 2 * n, inputs, (int[]) {n, n}, 2);
+    write_wires(net, "OUTPUT", n + 1, outputs, (int[]) {n + 1}, 1);
+
+    label_t *a = malloc(sizeof(label_t) * n), *b = malloc(sizeof(label_t) * n), *sum = malloc(sizeof(label_t) * (n + 1));
+    for (int i = 0; i < n; i++) {
+        a[i] = label("a", i);
+        b[i] = label("b", i);
+    }
+    ripple_add(net, a, b, n, sum);
+    write_outputs(net, sum, n + 1, "s");
+    free(a);
+    free(b);
+    free(sum);
+}
+
+// Function to generate an n-bit carry-lookahead adder: s = a + b. The carries are computed by a
+// Kogge-Stone parallel prefix network of generate and propagate signals, in log2(n) levels.
+void lookahead_adder(netlist_t *net, int n) {
+    const char *inputs[] = {"a", "b"}, *outputs[] = {"s"};
+    write_wires(net, "INPUT", 2 * n, inputs, (int[]) {n, n}, 2);
+    write_wires(net, "OUTPUT", n + 1, outputs, (int[]) {n + 1}, 1);
+
+    // The sum starts out as the propagate signals of the bits.
+    label_t *sum = malloc(sizeof(label_t) * (n + 1));
+    label_t *prefixP = malloc(sizeof(label_t) * n), *prefixG = malloc(sizeof(label_t) * n);
+    for (int i = 0; i < n; i++) {
+        sum[i] = prefixP[i] = gate2(net, "XOR", label("a", i), label("b", i));
+        prefixG[i] = gate2(net, "AND", label("a", i), label("b", i));
+    }
+
+    // After the level of distance d, prefixG[i] is the carry out of bits max(0, i - 2d + 1) ... i. Going from
+    // the top down lets each level read the previous level's values of the lower bits.
+    for (int d = 1; d < n; d *= 2)
+        for (int i = n - 1; i >= d; i--) {
+            prefixG[i] = gate2(net, "OR", prefixG[i], gate2(net, "AND", prefixP[i], prefixG[i - d]));
+            if (i >= 2 * d) prefixP[i] = gate2(net, "AND", prefixP[i], prefixP[i - d]);
+        }
+
+    for (int i = n - 1; i > 0; i--) sum[i] = gate2(net, "XOR", sum[i], prefixG[i - 1]);
+    sum[n] = prefixG[n - 1];
+    write_outputs(net, sum, n + 1, "s");
+    free(sum);
+    free(prefixP);
+    free(prefixG);
+}
+
+// Function to generate an n x n-bit array multiplier: p = a * b. Each row of partial products is added to
+// the running sum with a ripple carry adder.
+void multiplier(netlist_t *net, int n) {
+    const char *inputs[] = {"a", "b"}, *outputs[] = {"p"};
+    write_wires(net, "INPUT", 2 * n, inputs, (int[]) {n, n}, 2);
+    write_wires(net, "OUTPUT", 2 * n, outputs, (int[]) {2 * n}, 1);
+
+    label_t *product = malloc(sizeof(label_t) * 2 * n), *row = malloc(sizeof(label_t) * n);
+    for (int j = 0; j < 2 * n; j++) product[j] = j < n ? gate2(net, "AND", label("a", j), label("b", 0)) : constant(0);
+    for (int i = 1; i < n; i++) {
+        for (int j = 0; j < n; j++) row[j] = gate2(net, "AND", label("a", j), label("b", i));
+        ripple_add(net, product + i, row, n, product + i);
+    }
+    write_outputs(net, product, 2 * n, "p");
+    free(product);
+    free(row);
+}
+
+// Function to generate a 2^n-input multiplexer as a tree of 2:1 multiplexers: y = d[s].
+void mux_tree(netlist_t *net, int n) {
+    const char *inputs[] = {"s", "d"}, *outputs[] = {"y"};
+    write_wires(net, "INPUT", n + (1 << n), inputs, (int[]) {n, 1 << n}, 2);
+    write_wires(net, "OUTPUT", 1, outputs, (int[]) {1}, 1);
+
+    // Level k of the tree selects with bit k of s, from the least significant one.
+    label_t *level = malloc(sizeof(label_t) * (1 << n));
+    for (int i = 0; i < (1 << n); i++) level[i] = label("d", i);
+    for (int k = 0; k < n; k++)
+        for (int i = 0; i < (1 << (n - k - 1)); i++) {
+            label_t out = label("t", net->nTemps++);
+            fprintf(net->fp, "MULTIPLEXER 1 %s %s %s %s\n", level[2 * i].key, level[2 * i + 1].key, label("s", k).key, out.key);
+            level[i] = out;
+        }
+    write_outputs(net, level, 1, "y");
+    free(level);
+}
+
+// Function to generate an n to 2^n decoder as a tree: each input bit is decoded by a 1 to 2 decoder, and
+// the decoded bits are combined one at a time with AND gates. y[i] is 1 if and only if x = i.
+void decoder_tree(netlist_t *net, int n) {
+    const char *inputs[] = {"x"}, *outputs[] = {"y"};
+    write_wires(net, "INPUT", n, inputs, (int[]) {n}, 1);
+    write_wires(net, "OUTPUT", 1 << n, outputs, (int[]) {1 << n}, 1);
+
+    label_t *decoded = malloc(sizeof(label_t) * (1 << n)), *next = malloc(sizeof(label_t) * (1 << n));
+    int size = 1;
+    for (int k = n - 1; k >= 0; k--) {
+        label_t low = label("t", net->nTemps++), high = label("t", net->nTemps++);
+        fprintf(net->fp, "DECODER 1 %s %s %s\n", label("x", k).key, low.key, high.key);
+        for (int i = 0; i < size; i++) {
+            next[2 * i] = size == 1 ? low : gate2(net, "AND", decoded[i], low);
+            next[2 * i + 1] = size == 1 ? high : gate2(net, "AND", decoded[i], high);
+        }
+        size *= 2;
+        label_t *swap = decoded;
+        decoded = next;
+        next = swap;
+    }
+
+    // The most significant bit was decoded first, so decoded[i] matches x = i.
+    write_outputs(net, decoded, 1 << n, "y");
+    free(decoded);
+    free(next);
+}
+
+// Function to generate the parity of n inputs as a balanced tree of XOR gates.
+void parity_tree(netlist_t *net, int n) {
+    const char *inputs[] = {"x"}, *outputs[] = {"y"};
+    write_wires(net, "INPUT", n, inputs, (int[]) {n}, 1);
+    write_wires(net, "OUTPUT", 1, outputs, (int[]) {1}, 1);
+
+    label_t *level = malloc(sizeof(label_t) * n);
+    for (int i = 0; i < n; i++) level[i] = label("x", i);
+    for (int size = n; size > 1; size = (size + 1) / 2)
+        for (int i = 0; i < size / 2; i++) {
+            level[i] = gate2(net, "XOR", level[2 * i], level[2 * i + 1]);
+            if (size % 2 && i == size / 2 - 1) level[i + 1] = level[size - 1];
+        }
+    write_outputs(net, level, 1, "y");
+    free(level);
+}
+
+// Utility function to generate a pseudo-random number (xorshift64), so netlists are reproducible.
+unsigned long next_random(unsigned long *rng) {
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 7;
+    *rng ^= *rng << 17;
+    return *rng;
+}
+
+// Function to generate a random DAG of nGates gates over nInputs inputs, in depth levels of gates. Every
+// gate reads a wire of the previous level, so the longest path has depth gates, and its other input from any
+// earlier wire. A wire feeds at most maxFanout gates while other wires are available. The wires that feed
+// no gate are the outputs.
+int random_dag(netlist_t *net, int nInputs, int nGates, int depth, int maxFanout, unsigned long seed) {
+    static const char *types[] = {"AND", "OR", "NAND", "NOR", "XOR", "NOT"};
+    if (depth > nGates) return 1;
+
+    // Wires 0 ... nInputs - 1 are the inputs and wire nInputs + i is the output of gate i.
+    int nWires = nInputs + nGates;
+    int *levelStart = malloc(sizeof(int) * (depth + 2)), *fanout = calloc(nWires, sizeof(int));
+    int *in = malloc(sizeof(int) * 2 * nGates), *type = malloc(sizeof(int) * nGates);
+    unsigned long rng = seed * 0x9e3779b97f4a7c15UL + 1;
+    levelStart[0] = 0;
+    for (int l = 0; l <= depth; l++) levelStart[l + 1] = nInputs + (long) nGates * l / depth;
+
+    for (int l = 1; l <= depth; l++)
+        for (int g = levelStart[l] - nInputs; g < levelStart[l + 1] - nInputs; g++) {
+            type[g] = next_random(&rng) % 6;
+            for (int j = 0; j < (type[g] == 5 ? 1 : 2); j++) {
+                // The first input comes from the previous level, the second one from any earlier level.
+                int low = j ? 0 : levelStart[l - 1], range = levelStart[l] - low, wire = -1;
+                for (int tries = 0; tries < 8 && (wire < 0 || fanout[wire] >= maxFanout); tries++) wire = low + next_random(&rng) % range;
+                in[2 * g + j] = wire;
+                fanout[wire]++;
+            }
+        }
+
+    int nOutputs = 0;
+    for (int w = nInputs; w < nWires; w++) nOutputs += !fanout[w];
+    fprintf(net->fp, "INPUT %d", nInputs);
+    for (int i = nInputs - 1; i >= 0; i--) fprintf(net->fp, " %s", label("x", i).key);
+    fprintf(net->fp, "\nOUTPUT %d", nOutputs);
+    for (int w = nInputs; w < nWires; w++) if (!fanout[w]) fprintf(net->fp, " %s", label("g", w - nInputs).key);
+    fprintf(net->fp, "\n");
+
+    for (int g = 0; g < nGates; g++) {
+        label_t a = in[2 * g] < nInputs ? label("x", in[2 * g]) : label("g", in[2 * g] - nInputs);
+        if (type[g] == 5) {
+            gate_to(net, types[type[g]], a, NULL, label("g", g));
+            continue;
+        }
+        label_t b = in[2 * g + 1] < nInputs ? label("x", in[2 * g + 1]) : label("g", in[2 * g + 1] - nInputs);
+        gate_to(net, types[type[g]], a, &b, label("g", g));
+    }
+
+    free(levelStart);
+    free(fanout);
+    free(in);
+    free(type);
+    return 0;
+}
+
+int main(int argc, char const *argv[]) {
+    netlist_t net = {stdout, 0};
+    const char *circuit = argc > 2 ? argv[1] : "";
+    int n = argc > 2 ? atoi(argv[2]) : 0, res = 0;
+
+    if (n <= 0) res = 1;
+    else if (strcmp(circuit, "ripple") == 0 && argc == 3) ripple_adder(&net, n);
+    else if (strcmp(circuit, "lookahead") == 0 && argc == 3) lookahead_adder(&net, n);
+    else if (strcmp(circuit, "multiplier") == 0 && argc == 3) multiplier(&net, n);
+    else if (strcmp(circuit, "mux") == 0 && argc == 3 && n < 31) mux_tree(&net, n);
+    else if (strcmp(circuit, "decoder") == 0 && argc == 3 && n < 31) decoder_tree(&net, n);
+    else if (strcmp(circuit, "parity") == 0 && argc == 3) parity_tree(&net, n);
+    else if (strcmp(circuit, "random") == 0 && argc >= 6 && argc <= 7 && atoi(argv[3]) > 0 && atoi(argv[4]) > 0 && atoi(argv[5]) > 0)
+        res = random_dag(&net, n, atoi(argv[3]), atoi(argv[4]), atoi(argv[5]), argc == 7 ? strtoul(argv[6], NULL, 0) : 1);
+    else res = 1;
+
+    if (res) {
+        printf("Usage: %s ripple|lookahead|multiplier <bits>\n", argv[0]);
+        printf("       %s mux <select bits> | decoder <bits> | parity <inputs>\n", argv[0]);
+        printf("       %s random <inputs> <gates> <depth> <max fan-out> [<seed>]\n", argv[0]);
+        printf("Writes the netlist to stdout, in the format read by truthtable.\n");
+        return 1;
+    }
+    return 0;
+}
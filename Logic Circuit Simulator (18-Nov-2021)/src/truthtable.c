@@ -1,6 +1,9 @@
+#define _POSIX_C_SOURCE 199309L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define MAX_VARS    256
 
@@ -71,6 +74,13 @@ typedef struct {
 } stack_t;
 
 
+// Function to read a monotonic clock in seconds, for timing the phases of a run.
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 // Hash function for the wire label -> id mapping.
 int hash(char *key) {
     int x = 31;
@@ -240,7 +250,9 @@ void dfs(int curr, int *visited, gatenode_t **gatenodes, gatelist_t *gates, stac
 }
 
 // Function to build the circuit and generate the truthtable for all possible inputs.
-void build_circuit(wirelist_t *wires, gatelist_t *gates, circuitbuilder_t *builder, int nInputs, int nOutputs, int nWires) {
+// With timing, the time spent building the DAG and evaluating the rows is printed to stderr.
+void build_circuit(wirelist_t *wires, gatelist_t *gates, circuitbuilder_t *builder, int nInputs, int nOutputs, int nWires, int timing) {
+    double start = now_seconds();
     builder->nGatenodes = gates->nGates;
     builder->gatenodes = malloc(sizeof(gatenode_t *) * gates->nGates);
     
@@ -279,6 +291,9 @@ void build_circuit(wirelist_t *wires, gatelist_t *gates, circuitbuilder_t *build
     stack->stack = malloc(sizeof(int) * gates->nGates);
     for (int i = gates->nGates - 1; i >= 0; i--) if (!visited[i]) dfs(i, visited, builder->gatenodes, gates, stack);
 
+    double built = now_seconds();
+    if (timing) fprintf(stderr, "Graph build: %.6f s\n", built - start);
+
     for (int in = 0; in < (1 << nInputs); in++) {
         int *inputs = malloc(sizeof(int) * nInputs);
         int *outputs = malloc(sizeof(int) * nOutputs);
@@ -460,6 +475,11 @@ void build_circuit(wirelist_t *wires, gatelist_t *gates, circuitbuilder_t *build
         free(all_wires);
     }
 
+    if (timing) {
+        double seconds = now_seconds() - built;
+        fprintf(stderr, "Evaluation: %d rows in %.6f s (%.0f rows/s)\n", 1 << nInputs, seconds, seconds > 0 ? (1 << nInputs) / seconds : 0.0);
+    }
+
     // Debugging.
     // for (int i = builder->nGatenodes - 1; i >= 0 ; i--) printf("%d ", stack->stack[i]);
     // printf("\n");
@@ -629,11 +649,20 @@ int main(int argc, char const *argv[]) {
     init_wirelist(&wires);
     init_circuit(&gates);
 
+    // --timing prints the time spent parsing, building the DAG and evaluating the rows to stderr.
+    int timing = argc > 1 && strcmp(argv[1], "--timing") == 0;
+    if (timing) {
+        argv++;
+        argc--;
+    }
+
     if (argc == 1) {
+        double start = now_seconds();
         int res = parse_circuit(stdin, &wires, &gates, &nInputs, &nOutputs, &gateId, &wireId);
         if (res) return 1;
+        if (timing) fprintf(stderr, "Parse: %.6f s (%d gates, %d wires)\n", now_seconds() - start, gateId, wireId);
 
-        build_circuit(&wires, &gates, &builder, nInputs, nOutputs, wireId);
+        build_circuit(&wires, &gates, &builder, nInputs, nOutputs, wireId, timing);
     }
     else if (argc == 2) {
         FILE *fp = fopen(argv[1], "r");
@@ -642,8 +671,10 @@ int main(int argc, char const *argv[]) {
             return 1;
         }
 
+        double start = now_seconds();
         int res = parse_circuit(fp, &wires, &gates, &nInputs, &nOutputs, &gateId, &wireId);
         if (res) return 1;
+        if (timing) fprintf(stderr, "Parse: %.6f s (%d gates, %d wires)\n", now_seconds() - start, gateId, wireId);
 
         fclose(fp);
 
@@ -651,7 +682,7 @@ int main(int argc, char const *argv[]) {
         // for (wire_t *wire = wires.head; wire != NULL; wire = wire->next) printf("%s: %d ", wire->key, wire->id);
         // printf("\n");
 
-        build_circuit(&wires, &gates, &builder, nInputs, nOutputs, wireId);
+        build_circuit(&wires, &gates, &builder, nInputs, nOutputs, wireId, timing);
     }
     else {
         printf("Too many arguments.\n");